@@ -0,0 +1,288 @@
+/* gifdecoder.c -- Parallel GIF frame decoding.
+ * version 0.2
+ * 
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ * 
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * For more information, please refer to <http://unlicense.org/>
+ */
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#   define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "gifdecoder.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <pthread.h>
+#   include <unistd.h>
+#endif
+
+/* Frames decoded ahead of the consumer, per worker. */
+#define SLOTS_PER_THREAD 2
+
+#ifdef _WIN32
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE Cond;
+
+static int cpuCount(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+}
+
+static void mutexInit(Mutex *mutex) { InitializeCriticalSection(mutex); }
+static void mutexDestroy(Mutex *mutex) { DeleteCriticalSection(mutex); }
+static void mutexLock(Mutex *mutex) { EnterCriticalSection(mutex); }
+static void mutexUnlock(Mutex *mutex) { LeaveCriticalSection(mutex); }
+static void condInit(Cond *cond) { InitializeConditionVariable(cond); }
+static void condDestroy(Cond *cond) { (void)cond; }
+static void condWait(Cond *cond, Mutex *mutex)
+{
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+static void condBroadcast(Cond *cond) { WakeAllConditionVariable(cond); }
+
+static void *workerMain(void *arg);
+
+static DWORD WINAPI workerThunk(LPVOID arg)
+{
+    workerMain(arg);
+    return 0;
+}
+
+static int threadStart(Thread *thread, void *arg)
+{
+    *thread = CreateThread(NULL, 0, workerThunk, arg, 0, NULL);
+    return *thread == NULL;
+}
+
+static void threadJoin(Thread thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+#else
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Cond;
+
+static int cpuCount(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static void mutexInit(Mutex *mutex) { pthread_mutex_init(mutex, NULL); }
+static void mutexDestroy(Mutex *mutex) { pthread_mutex_destroy(mutex); }
+static void mutexLock(Mutex *mutex) { pthread_mutex_lock(mutex); }
+static void mutexUnlock(Mutex *mutex) { pthread_mutex_unlock(mutex); }
+static void condInit(Cond *cond) { pthread_cond_init(cond, NULL); }
+static void condDestroy(Cond *cond) { pthread_cond_destroy(cond); }
+static void condWait(Cond *cond, Mutex *mutex)
+{
+    pthread_cond_wait(cond, mutex);
+}
+static void condBroadcast(Cond *cond) { pthread_cond_broadcast(cond); }
+
+static void *workerMain(void *arg);
+
+static int threadStart(Thread *thread, void *arg)
+{
+    return pthread_create(thread, NULL, workerMain, arg);
+}
+
+static void threadJoin(Thread thread)
+{
+    pthread_join(thread, NULL);
+}
+#endif
+
+/* Frame n is decoded into slot n % slotCt, once frame n - slotCt has been
+ * released.
+ */
+struct Slot {
+    uint8_t *raster;
+    size_t rasterCap;
+    int frame;      /* frame decoded into raster, or -1 */
+    bool ok;
+};
+
+struct GifDecoder {
+    struct GifMap const *map;
+    struct GifFrameInfo const *frames;
+    int frameCt;
+    int nextFrame;      /* next frame for a worker to decode */
+    int releasedCt;     /* frames released by the consumer */
+    bool stop;
+    struct Slot *slots;
+    int slotCt;
+    Thread *threads;
+    int threadCt;
+    Mutex lock;
+    Cond changed;
+};
+
+static bool decodeFrame
+(struct GifDecoder *decoder, GifFileType *gifFile, int frame,
+ struct Slot *slot)
+{
+    GifImageDesc const *desc = &decoder->frames[frame].desc;
+    size_t pixCount = (size_t)desc->Width * desc->Height;
+
+    if (gifFile == NULL)
+        return false;
+    if (pixCount > slot->rasterCap) {
+        uint8_t *raster = realloc(slot->raster, pixCount);
+        if (raster == NULL)
+            return false;
+        slot->raster = raster;
+        slot->rasterCap = pixCount;
+    }
+    return readIndexedFrame(gifFile, decoder->frames + frame, slot->raster)
+        == GIF_OK;
+}
+
+static void *workerMain(void *arg)
+{
+    struct GifDecoder *decoder = arg;
+    struct GifMap view;
+    int err;
+    GifFileType *gifFile = openMappedGifView(decoder->map, &view, &err);
+
+    mutexLock(&decoder->lock);
+    for (;;) {
+        int frame;
+        struct Slot *slot;
+        bool ok;
+
+        while (!decoder->stop && decoder->nextFrame < decoder->frameCt &&
+                decoder->nextFrame >= decoder->releasedCt + decoder->slotCt)
+            condWait(&decoder->changed, &decoder->lock);
+        if (decoder->stop || decoder->nextFrame >= decoder->frameCt)
+            break;
+
+        frame = decoder->nextFrame++;
+        slot = decoder->slots + frame % decoder->slotCt;
+        mutexUnlock(&decoder->lock);
+
+        ok = decodeFrame(decoder, gifFile, frame, slot);
+
+        mutexLock(&decoder->lock);
+        slot->frame = frame;
+        slot->ok = ok;
+        condBroadcast(&decoder->changed);
+    }
+    mutexUnlock(&decoder->lock);
+
+    if (gifFile != NULL)
+        DGifCloseFile(gifFile, &err);
+    return NULL;
+}
+
+struct GifDecoder *newGifDecoder(struct GifMap const *map,
+        struct GifFrameInfo const *frames, int frameCt, int threadCt)
+{
+    struct GifDecoder *decoder = calloc(1, sizeof(*decoder));
+
+    if (decoder == NULL)
+        return NULL;
+    if (threadCt <= 0)
+        threadCt = cpuCount();
+    if (threadCt > frameCt)
+        threadCt = frameCt > 0 ? frameCt : 1;
+
+    decoder->map = map;
+    decoder->frames = frames;
+    decoder->frameCt = frameCt;
+    decoder->slotCt = SLOTS_PER_THREAD * threadCt;
+    decoder->slots = calloc(decoder->slotCt, sizeof(*decoder->slots));
+    decoder->threads = calloc(threadCt, sizeof(*decoder->threads));
+    if (decoder->slots == NULL || decoder->threads == NULL) {
+        free(decoder->slots);
+        free(decoder->threads);
+        free(decoder);
+        return NULL;
+    }
+    for (int i = 0; i < decoder->slotCt; i++)
+        decoder->slots[i].frame = -1;
+    mutexInit(&decoder->lock);
+    condInit(&decoder->changed);
+
+    for (int i = 0; i < threadCt; i++) {
+        if (threadStart(decoder->threads + i, decoder) != 0)
+            break;
+        decoder->threadCt++;
+    }
+    if (decoder->threadCt == 0) {
+        freeGifDecoder(decoder);
+        return NULL;
+    }
+    return decoder;
+}
+
+void freeGifDecoder(struct GifDecoder *decoder)
+{
+    mutexLock(&decoder->lock);
+    decoder->stop = true;
+    condBroadcast(&decoder->changed);
+    mutexUnlock(&decoder->lock);
+
+    for (int i = 0; i < decoder->threadCt; i++)
+        threadJoin(decoder->threads[i]);
+
+    condDestroy(&decoder->changed);
+    mutexDestroy(&decoder->lock);
+    for (int i = 0; i < decoder->slotCt; i++)
+        free(decoder->slots[i].raster);
+    free(decoder->slots);
+    free(decoder->threads);
+    free(decoder);
+}
+
+uint8_t const *gifDecoderTake(struct GifDecoder *decoder, int frame)
+{
+    struct Slot *slot = decoder->slots + frame % decoder->slotCt;
+
+    mutexLock(&decoder->lock);
+    while (slot->frame != frame)
+        condWait(&decoder->changed, &decoder->lock);
+    mutexUnlock(&decoder->lock);
+
+    return slot->ok ? slot->raster : NULL;
+}
+
+void gifDecoderRelease(struct GifDecoder *decoder, int frame)
+{
+    mutexLock(&decoder->lock);
+    decoder->slots[frame % decoder->slotCt].frame = -1;
+    decoder->releasedCt = frame + 1;
+    condBroadcast(&decoder->changed);
+    mutexUnlock(&decoder->lock);
+}
@@ -0,0 +1,61 @@
+/* gifdecoder.h -- Parallel GIF frame decoding.
+ * version 0.2
+ * 
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ * 
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * For more information, please refer to <http://unlicense.org/>
+ */
+/* gifdecoder.h - Decode indexed GIF frames on a pool of worker threads, ahead
+ * of a consumer that takes them in order.
+ */
+#ifndef GIFDECODER_H_
+#define GIFDECODER_H_
+
+#include <stdint.h>
+
+#include "gifmap.h"
+
+struct GifDecoder;
+
+/* Start decoding frames.
+ * map, frames - Must outlive the decoder.
+ * threadCt - Number of worker threads, or 0 for one per CPU.
+ * Returns decoder, or NULL on failure.
+ */
+struct GifDecoder *newGifDecoder(struct GifMap const *map,
+        struct GifFrameInfo const *frames, int frameCt, int threadCt);
+
+/* Stop any workers and free the decoder. */
+void freeGifDecoder(struct GifDecoder *decoder);
+
+/* Wait for a frame to be decoded.  Frames must be taken in order, each one
+ * released before taking the next.
+ * Returns the frame's raster, or NULL if it failed to decode.
+ */
+uint8_t const *gifDecoderTake(struct GifDecoder *decoder, int frame);
+
+/* Done with the frame last taken; its raster may be reused. */
+void gifDecoderRelease(struct GifDecoder *decoder, int frame);
+
+#endif
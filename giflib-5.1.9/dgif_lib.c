@@ -27,20 +27,38 @@ two modules will be linked.  Preserve this property!
 /* compose unsigned little endian value */
 #define UNSIGNED_LITTLE_ENDIAN(lo, hi)	((lo) | ((hi) << 8))
 
+/* Take Len bytes in place from memory input, or NULL if there aren't enough */
+static const GifByteType *MemoryTake(GifFilePrivateType *Private, size_t Len) {
+    const GifByteType *Data;
+    if (Private->MemSize - Private->MemPos < Len)
+        return NULL;
+    Data = Private->MemData + Private->MemPos;
+    Private->MemPos += Len;
+    return Data;
+}
+
 /* avoid extra function call in case we use fread (TVT) */
 static int InternalRead(GifFileType *gif, GifByteType *buf, int len) {
+    GifFilePrivateType *Private = (GifFilePrivateType*)gif->Private;
     //fprintf(stderr, "### Read: %d\n", len);
+    if (Private->MemData) {
+        size_t Avail = Private->MemSize - Private->MemPos;
+        if ((size_t)len > Avail)
+            len = (int)Avail;
+        memcpy(buf, MemoryTake(Private, len), len);
+        return len;
+    }
     return 
-	(((GifFilePrivateType*)gif->Private)->Read ?
-	 ((GifFilePrivateType*)gif->Private)->Read(gif,buf,len) : 
-	 fread(buf,1,len,((GifFilePrivateType*)gif->Private)->File));
+	(Private->Read ?
+	 Private->Read(gif,buf,len) : 
+	 fread(buf,1,len,Private->File));
 }
 
 static int DGifGetWord(GifFileType *GifFile, GifWord *Word);
 static int DGifSetupDecompress(GifFileType *GifFile);
 static int DGifDecompressLine(GifFileType *GifFile, GifPixelType *Line,
                               int LineLen);
-static int DGifGetPrefixChar(GifPrefixType *Prefix, int Code, int ClearCode);
+static int DGifCodeLength(GifFilePrivateType *Private, int Code, int NewCode);
 static int DGifDecompressInput(GifFileType *GifFile, int *Code);
 static int DGifBufferedInput(GifFileType *GifFile, GifByteType *Buf,
                              GifByteType *NextByte);
@@ -232,6 +250,118 @@ DGifOpen(void *userData, InputFunc readFunc, int *Error)
     return GifFile;
 }
 
+/******************************************************************************
+ GifFileType constructor reading from a buffer holding the whole GIF file,
+ such as a memory mapped file.  Data blocks returned by DGifGetExtensionNext
+ and DGifGetCodeNext, and compressed image data, are read in place from the
+ buffer rather than copied.  The buffer must outlive the GifFileType.
+******************************************************************************/
+GifFileType *
+DGifOpenMem(const GifByteType *Data, size_t Size, int *Error)
+{
+    char Buf[GIF_STAMP_LEN + 1];
+    GifFileType *GifFile;
+    GifFilePrivateType *Private;
+
+    GifFile = (GifFileType *)malloc(sizeof(GifFileType));
+    if (GifFile == NULL) {
+        if (Error != NULL)
+	    *Error = D_GIF_ERR_NOT_ENOUGH_MEM;
+        return NULL;
+    }
+
+    memset(GifFile, '\0', sizeof(GifFileType));
+
+    /* Belt and suspenders, in case the null pointer isn't zero */
+    GifFile->SavedImages = NULL;
+    GifFile->SColorMap = NULL;
+
+    Private = (GifFilePrivateType *)calloc(1, sizeof(GifFilePrivateType));
+    if (!Private) {
+        if (Error != NULL)
+	    *Error = D_GIF_ERR_NOT_ENOUGH_MEM;
+        free((char *)GifFile);
+        return NULL;
+    }
+
+    GifFile->Private = (void *)Private;
+    Private->FileHandle = 0;
+    Private->File = NULL;
+    Private->FileState = FILE_STATE_READ;
+    Private->Read = NULL;
+    Private->MemData = Data;
+    Private->MemSize = Data ? Size : 0;
+    Private->MemPos = 0;
+    GifFile->UserData = NULL;
+
+    /* Lets see if this is a GIF file: */
+    if (Data == NULL ||
+            InternalRead(GifFile, (unsigned char *)Buf, GIF_STAMP_LEN) != GIF_STAMP_LEN) {
+        if (Error != NULL)
+	    *Error = D_GIF_ERR_READ_FAILED;
+        free((char *)Private);
+        free((char *)GifFile);
+        return NULL;
+    }
+
+    /* Check for GIF prefix at start of file */
+    Buf[GIF_STAMP_LEN] = '\0';
+    if (strncmp(GIF_STAMP, Buf, GIF_VERSION_POS) != 0) {
+        if (Error != NULL)
+	    *Error = D_GIF_ERR_NOT_GIF_FILE;
+        free((char *)Private);
+        free((char *)GifFile);
+        return NULL;
+    }
+
+    if (DGifGetScreenDesc(GifFile) == GIF_ERROR) {
+        free((char *)Private);
+        free((char *)GifFile);
+        if (Error != NULL)
+	    *Error = D_GIF_ERR_NO_SCRN_DSCR;
+        return NULL;
+    }
+
+    GifFile->Error = 0;
+
+    /* What version of GIF? */
+    Private->gif89 = (Buf[GIF_VERSION_POS] == '9');
+
+    return GifFile;
+}
+
+/******************************************************************************
+ Get or set the read position of a GifFileType opened by DGifOpenMem, as an
+ offset into its buffer.  Seeking to a record saved with DGifTellMem, e.g. an
+ image descriptor, lets that record be read again or out of order.
+******************************************************************************/
+int
+DGifTellMem(const GifFileType *GifFile, size_t *Pos)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
+
+    if (Private->MemData == NULL)
+        return GIF_ERROR;
+    *Pos = Private->MemPos;
+    return GIF_OK;
+}
+
+int
+DGifSeekMem(GifFileType *GifFile, size_t Pos)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
+
+    if (Private->MemData == NULL || Pos > Private->MemSize) {
+        GifFile->Error = D_GIF_ERR_READ_FAILED;
+        return GIF_ERROR;
+    }
+    Private->MemPos = Pos;
+    /* drop whatever was left of the current data block */
+    Private->Buf[0] = 0;
+    Private->PixelCount = 0;
+    return GIF_OK;
+}
+
 /******************************************************************************
  This routine should be called before any other DGif calls. Note that
  this routine is called automatically from DGif file open routines.
@@ -600,7 +730,15 @@ DGifGetExtensionNext(GifFileType *GifFile, GifByteType ** Extension)
     }
     //fprintf(stderr, "### DGifGetExtensionNext sees %d\n", Buf);
 
-    if (Buf > 0) {
+    if (Buf > 0 && Private->MemData) {
+        /* The block is already in Pascal string notation in memory. */
+        const GifByteType *Block = MemoryTake(Private, Buf);
+        if (Block == NULL) {
+            GifFile->Error = D_GIF_ERR_READ_FAILED;
+            return GIF_ERROR;
+        }
+        *Extension = (GifByteType *)Block - 1;
+    } else if (Buf > 0) {
         *Extension = Private->Buf;    /* Use private unused buffer. */
         (*Extension)[0] = Buf;  /* Pascal strings notation (pos. 0 is len.). */
 	/* coverity[tainted_data,check_return] */
@@ -778,7 +916,15 @@ DGifGetCodeNext(GifFileType *GifFile, GifByteType **CodeBlock)
     }
 
     /* coverity[lower_bounds] */
-    if (Buf > 0) {
+    if (Buf > 0 && Private->MemData) {
+        /* The block is already in Pascal string notation in memory. */
+        const GifByteType *Block = MemoryTake(Private, Buf);
+        if (Block == NULL) {
+            GifFile->Error = D_GIF_ERR_READ_FAILED;
+            return GIF_ERROR;
+        }
+        *CodeBlock = (GifByteType *)Block - 1;
+    } else if (Buf > 0) {
         *CodeBlock = Private->Buf;    /* Use private unused buffer. */
         (*CodeBlock)[0] = Buf;  /* Pascal strings notation (pos. 0 is len.). */
 	/* coverity[tainted_data] */
@@ -803,7 +949,6 @@ DGifSetupDecompress(GifFileType *GifFile)
 {
     int i, BitsPerPixel;
     GifByteType CodeSize;
-    GifPrefixType *Prefix;
     GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
 
     /* coverity[check_return] */
@@ -830,9 +975,16 @@ DGifSetupDecompress(GifFileType *GifFile)
     Private->CrntShiftState = 0;    /* No information in CrntShiftDWord. */
     Private->CrntShiftDWord = 0;
 
-    Prefix = Private->Prefix;
-    for (i = 0; i <= LZ_MAX_CODE; i++)
-        Prefix[i] = NO_SUCH_CODE;
+    /* Only the pixel codes need setting up.  Other codes are defined in order
+     * as they are decoded, so the running code tells which are valid, and no
+     * table needs clearing here or on a clear code.
+     */
+    for (i = 0; i < Private->ClearCode; i++) {
+        Private->Prefix[i] = NO_SUCH_CODE;
+        Private->Suffix[i] = i;
+        Private->Length[i] = 1;
+        Private->FirstChar[i] = i;
+    }
 
     return GIF_OK;
 }
@@ -842,19 +994,27 @@ DGifSetupDecompress(GifFileType *GifFile)
  This version decompress the given GIF file into Line of length LineLen.
  This routine can be called few times (one per scan line, for example), in
  order the complete the whole image.
+
+ Each string table entry records its length and first pixel alongside its
+ prefix and suffix, so a string is written straight to its place in Line by
+ walking its prefix chain back from the end.  Only a string which overruns
+ Line is put on the stack, to be popped by the next call.
 ******************************************************************************/
 static int
 DGifDecompressLine(GifFileType *GifFile, GifPixelType *Line, int LineLen)
 {
     int i = 0;
-    int j, CrntCode, EOFCode, ClearCode, CrntPrefix, LastCode, StackPtr;
-    GifByteType *Stack, *Suffix;
-    GifPrefixType *Prefix;
+    int CrntCode, EOFCode, ClearCode, LastCode, StackPtr, NewCode;
+    int StrPrefix, StrLen, Code;
+    GifByteType StrSuffix, NewSuffix, *Stack, *Suffix, *FirstChar, *Out;
+    GifPrefixType *Prefix, *Length;
     GifFilePrivateType *Private = (GifFilePrivateType *) GifFile->Private;
 
     StackPtr = Private->StackPtr;
     Prefix = Private->Prefix;
     Suffix = Private->Suffix;
+    Length = Private->Length;
+    FirstChar = Private->FirstChar;
     Stack = Private->Stack;
     EOFCode = Private->EOFCode;
     ClearCode = Private->ClearCode;
@@ -874,6 +1034,10 @@ DGifDecompressLine(GifFileType *GifFile, GifPixelType *Line, int LineLen)
         if (DGifDecompressInput(GifFile, &CrntCode) == GIF_ERROR)
             return GIF_ERROR;
 
+        /* Table entry this code defines, if any: entries are defined in
+         * order, so every code from EOFCode + 1 up to it is in the table. */
+        NewCode = Private->RunningCode - 2;
+
         if (CrntCode == EOFCode) {
             /* Note however that usually we will not be here as we will stop
              * decoding as soon as we got all the pixel, or EOF code will
@@ -882,78 +1046,72 @@ DGifDecompressLine(GifFileType *GifFile, GifPixelType *Line, int LineLen)
 	    return GIF_ERROR;
         } else if (CrntCode == ClearCode) {
             /* We need to start over again: */
-            for (j = 0; j <= LZ_MAX_CODE; j++)
-                Prefix[j] = NO_SUCH_CODE;
             Private->RunningCode = Private->EOFCode + 1;
             Private->RunningBits = Private->BitsPerPixel + 1;
             Private->MaxCode1 = 1 << Private->RunningBits;
             LastCode = Private->LastCode = NO_SUCH_CODE;
+        } else if (CrntCode < ClearCode) {
+            /* This is simple - its pixel scalar, so add it to output: */
+            Line[i++] = CrntCode;
+            NewSuffix = CrntCode;
         } else {
-            /* Its regular code - if in pixel range simply add it to output
-             * stream, otherwise trace to codes linked list until the prefix
-             * is in pixel range: */
-            if (CrntCode < ClearCode) {
-                /* This is simple - its pixel scalar, so add it to output: */
-                Line[i++] = CrntCode;
-            } else {
-                /* Its a code to needed to be traced: trace the linked list
-                 * until the prefix is a pixel, while pushing the suffix
-                 * pixels on our stack. If we done, pop the stack in reverse
-                 * (thats what stack is good for!) order to output.  */
-                if (Prefix[CrntCode] == NO_SUCH_CODE) {
-                    CrntPrefix = LastCode;
-
-                    /* Only allowed if CrntCode is exactly the running code:
-                     * In that case CrntCode = XXXCode, CrntCode or the
-                     * prefix code is last code and the suffix char is
-                     * exactly the prefix of last code! */
-                    if (CrntCode == Private->RunningCode - 2) {
-                        Suffix[Private->RunningCode - 2] =
-                           Stack[StackPtr++] = DGifGetPrefixChar(Prefix,
-                                                                 LastCode,
-                                                                 ClearCode);
-                    } else {
-                        Suffix[Private->RunningCode - 2] =
-                           Stack[StackPtr++] = DGifGetPrefixChar(Prefix,
-                                                                 CrntCode,
-                                                                 ClearCode);
-                    }
-                } else
-                    CrntPrefix = CrntCode;
-
-                /* Now (if image is O.K.) we should not get a NO_SUCH_CODE
-                 * during the trace. As we might loop forever, in case of
-                 * defective image, we use StackPtr as loop counter and stop
-                 * before overflowing Stack[]. */
-                while (StackPtr < LZ_MAX_CODE &&
-                       CrntPrefix > ClearCode && CrntPrefix <= LZ_MAX_CODE) {
-                    Stack[StackPtr++] = Suffix[CrntPrefix];
-                    CrntPrefix = Prefix[CrntPrefix];
+            /* Split the string into the prefix string and final pixel. */
+            if (CrntCode < NewCode) {
+                if (DGifCodeLength(Private, CrntCode, NewCode) == 0) {
+                    GifFile->Error = D_GIF_ERR_IMAGE_DEFECT;
+                    return GIF_ERROR;
                 }
-                if (StackPtr >= LZ_MAX_CODE || CrntPrefix > LZ_MAX_CODE) {
+                StrPrefix = Prefix[CrntCode];
+                StrSuffix = Suffix[CrntCode];
+                NewSuffix = FirstChar[CrntCode];
+            } else {
+                /* Not in the table yet.  Only allowed if CrntCode is exactly
+                 * the code being defined: then its string is the last string
+                 * plus the last string's first pixel.  Any other code is
+                 * decoded as before, with the bogus NO_SUCH_CODE pixel. */
+                if (LastCode == NO_SUCH_CODE ||
+                        DGifCodeLength(Private, LastCode, NewCode) == 0) {
                     GifFile->Error = D_GIF_ERR_IMAGE_DEFECT;
                     return GIF_ERROR;
                 }
-                /* Push the last character on stack: */
-                Stack[StackPtr++] = CrntPrefix;
+                StrPrefix = LastCode;
+                if (CrntCode == NewCode)
+                    StrSuffix = FirstChar[LastCode];
+                else
+                    StrSuffix = (GifByteType)NO_SUCH_CODE;
+                NewSuffix = StrSuffix;
+            }
 
-                /* Now lets pop all the stack into output: */
+            StrLen = Length[StrPrefix] + 1;
+            if (StrLen <= LineLen - i) {
+                /* Write the string back to front into its place. */
+                Out = Line + i + StrLen;
+                *--Out = StrSuffix;
+                for (Code = StrPrefix; Code > EOFCode; Code = Prefix[Code])
+                    *--Out = Suffix[Code];
+                *--Out = Code;
+                i += StrLen;
+            } else {
+                /* Doesn't fit: stack it all, then pop what fits. */
+                Stack[StackPtr++] = StrSuffix;
+                for (Code = StrPrefix; Code > EOFCode; Code = Prefix[Code])
+                    Stack[StackPtr++] = Suffix[Code];
+                Stack[StackPtr++] = Code;
                 while (StackPtr != 0 && i < LineLen)
                     Line[i++] = Stack[--StackPtr];
             }
-            if (LastCode != NO_SUCH_CODE && Private->RunningCode - 2 < LZ_MAX_CODE && Prefix[Private->RunningCode - 2] == NO_SUCH_CODE) {
-                Prefix[Private->RunningCode - 2] = LastCode;
-
-                if (CrntCode == Private->RunningCode - 2) {
-                    /* Only allowed if CrntCode is exactly the running code:
-                     * In that case CrntCode = XXXCode, CrntCode or the
-                     * prefix code is last code and the suffix char is
-                     * exactly the prefix of last code! */
-                    Suffix[Private->RunningCode - 2] =
-                       DGifGetPrefixChar(Prefix, LastCode, ClearCode);
+        }
+
+        if (CrntCode != ClearCode) {
+            if (LastCode != NO_SUCH_CODE && NewCode < LZ_MAX_CODE) {
+                Prefix[NewCode] = LastCode;
+                Suffix[NewCode] = NewSuffix;
+                if (DGifCodeLength(Private, LastCode, NewCode) != 0) {
+                    Length[NewCode] = Length[LastCode] + 1;
+                    FirstChar[NewCode] = FirstChar[LastCode];
                 } else {
-                    Suffix[Private->RunningCode - 2] =
-                       DGifGetPrefixChar(Prefix, CrntCode, ClearCode);
+                    /* Prefix not in the table yet: trace it when used. */
+                    Length[NewCode] = 0;
                 }
             }
             LastCode = CrntCode;
@@ -967,23 +1125,34 @@ DGifDecompressLine(GifFileType *GifFile, GifPixelType *Line, int LineLen)
 }
 
 /******************************************************************************
- Routine to trace the Prefixes linked list until we get a prefix which is
- not code, but a pixel value (less than ClearCode). Returns that pixel value.
+ Get the length of a code's string, or 0 if it can't be traced to a pixel
+ through codes in the table, which holds every code below NewCode.  An entry
+ defined while its prefix wasn't in the table yet has no length recorded; its
+ prefix chain is traced now, and the length recorded if the chain is complete.
  If image is defective, we might loop here forever, so we limit the loops to
  the maximum possible if image O.k. - LZ_MAX_CODE times.
 ******************************************************************************/
 static int
-DGifGetPrefixChar(GifPrefixType *Prefix, int Code, int ClearCode)
+DGifCodeLength(GifFilePrivateType *Private, int Code, int NewCode)
 {
-    int i = 0;
-
-    while (Code > ClearCode && i++ <= LZ_MAX_CODE) {
-        if (Code > LZ_MAX_CODE) {
-            return NO_SUCH_CODE;
-        }
-        Code = Prefix[Code];
+    int Crnt = Code, Len = 1;
+
+    if (Code < Private->ClearCode)
+        return 1;
+    if (Code <= Private->EOFCode || Code >= NewCode)
+        return 0;
+    if (Private->Length[Code] != 0)
+        return Private->Length[Code];
+
+    while (Crnt > Private->EOFCode) {
+        if (Crnt >= NewCode || Len >= LZ_MAX_CODE)
+            return 0;
+        Crnt = Private->Prefix[Crnt];
+        Len++;
     }
-    return Code;
+    Private->Length[Code] = Len;
+    Private->FirstChar[Code] = Crnt;
+    return Len;
 }
 
 /******************************************************************************
@@ -1049,13 +1218,34 @@ DGifDecompressInput(GifFileType *GifFile, int *Code)
         return GIF_ERROR;
     }
     
+    if (Private->CrntShiftState < Private->RunningBits && Private->Buf[0] >= 8) {
+        /* At least 8 bytes left in this data block: refill as many whole
+         * bytes as fit with one 8-byte load.  Bits of the byte that only
+         * partly fits are ORed in again, unchanged, by the next refill. */
+        const GifByteType *Ptr = Private->MemData ? Private->BlockPtr
+                                 : &Private->Buf[Private->Buf[1]];
+        uint64_t Word = (uint64_t)Ptr[0] | (uint64_t)Ptr[1] << 8 |
+                        (uint64_t)Ptr[2] << 16 | (uint64_t)Ptr[3] << 24 |
+                        (uint64_t)Ptr[4] << 32 | (uint64_t)Ptr[5] << 40 |
+                        (uint64_t)Ptr[6] << 48 | (uint64_t)Ptr[7] << 56;
+        int Take = (63 - Private->CrntShiftState) >> 3;
+
+        Private->CrntShiftDWord |= Word << Private->CrntShiftState;
+        Private->CrntShiftState += Take * 8;
+        Private->Buf[0] -= Take;
+        if (Private->MemData)
+            Private->BlockPtr += Take;
+        else
+            Private->Buf[1] += Take;
+    }
+
     while (Private->CrntShiftState < Private->RunningBits) {
         /* Needs to get more bytes from input stream for next code: */
         if (DGifBufferedInput(GifFile, Private->Buf, &NextByte) == GIF_ERROR) {
             return GIF_ERROR;
         }
         Private->CrntShiftDWord |=
-	    ((unsigned long)NextByte) << Private->CrntShiftState;
+	    ((uint64_t)NextByte) << Private->CrntShiftState;
         Private->CrntShiftState += 8;
     }
     *Code = Private->CrntShiftDWord & CodeMasks[Private->RunningBits];
@@ -1086,6 +1276,32 @@ DGifDecompressInput(GifFileType *GifFile, int *Code)
 static int
 DGifBufferedInput(GifFileType *GifFile, GifByteType *Buf, GifByteType *NextByte)
 {
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
+
+    if (Private->MemData) {
+        /* Read in place: Buf[0] counts bytes left in the block at BlockPtr. */
+        if (Buf[0] == 0) {
+            const GifByteType *Len = MemoryTake(Private, 1);
+            if (Len == NULL) {
+                GifFile->Error = D_GIF_ERR_READ_FAILED;
+                return GIF_ERROR;
+            }
+            if (*Len == 0) {
+                GifFile->Error = D_GIF_ERR_IMAGE_DEFECT;
+                return GIF_ERROR;
+            }
+            Private->BlockPtr = MemoryTake(Private, *Len);
+            if (Private->BlockPtr == NULL) {
+                GifFile->Error = D_GIF_ERR_READ_FAILED;
+                return GIF_ERROR;
+            }
+            Buf[0] = *Len;
+        }
+        *NextByte = *Private->BlockPtr++;
+        Buf[0]--;
+        return GIF_OK;
+    }
+
     if (Buf[0] == 0) {
         /* Needs to read the next buffer - this one is empty: */
 	/* coverity[check_return] */
@@ -180,6 +180,9 @@ GifFileType *DGifOpenFileName(const char *GifFileName, int *Error);
 GifFileType *DGifOpenFileHandle(int GifFileHandle, int *Error);
 int DGifSlurp(GifFileType * GifFile);
 GifFileType *DGifOpen(void *userPtr, InputFunc readFunc, int *Error);    /* new one (TVT) */
+GifFileType *DGifOpenMem(const GifByteType *Data, size_t Size, int *Error);
+int DGifTellMem(const GifFileType *GifFile, size_t *Pos);
+int DGifSeekMem(GifFileType *GifFile, size_t Pos);
     int DGifCloseFile(GifFileType * GifFile, int *ErrorCode);
 
 #define D_GIF_SUCCEEDED          0
@@ -45,7 +45,7 @@ typedef struct GifFilePrivateType {
       CrntCode,    /* Current algorithm code. */
       StackPtr,    /* For character stack (see below). */
       CrntShiftState;    /* Number of bits in CrntShiftDWord. */
-    unsigned long CrntShiftDWord;   /* For bytes decomposition into codes. */
+    uint64_t CrntShiftDWord;    /* For bytes decomposition into codes. */
     unsigned long PixelCount;   /* Number of pixels in image. */
     FILE *File;    /* File as stream. */
     InputFunc Read;     /* function to read gif input (TVT) */
@@ -54,8 +54,14 @@ typedef struct GifFilePrivateType {
     GifByteType Stack[LZ_MAX_CODE]; /* Decoded pixels are stacked here. */
     GifByteType Suffix[LZ_MAX_CODE + 1];    /* So we can trace the codes. */
     GifPrefixType Prefix[LZ_MAX_CODE + 1];
+    GifPrefixType Length[LZ_MAX_CODE + 1];  /* String length of each code. */
+    GifByteType FirstChar[LZ_MAX_CODE + 1]; /* First pixel of each code. */
     GifHashTableType *HashTable;
     bool gif89;
+    const GifByteType *MemData; /* Whole file, if reading from memory. */
+    size_t MemSize;
+    size_t MemPos;      /* Read position in MemData. */
+    const GifByteType *BlockPtr;    /* Next byte of data block in MemData. */
 } GifFilePrivateType;
 
 #ifndef HAVE_REALLOCARRAY
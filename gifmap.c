@@ -0,0 +1,320 @@
+/* gifmap.c -- Memory-mapped GIF input.
+ * version 0.2
+ * 
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ * 
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * For more information, please refer to <http://unlicense.org/>
+ */
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#   define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "gifmap.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+#ifdef _WIN32
+static int mapFile(char const *filename, struct GifMap *map)
+{
+    HANDLE file, mapping;
+    LARGE_INTEGER size;
+
+    file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return 1;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return 1;
+    }
+    map->size = (size_t)size.QuadPart;
+    if (map->size == 0) {
+        /* can't map empty files; the decoder will report a read failure */
+        CloseHandle(file);
+        return 0;
+    }
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL)
+        return 1;
+    map->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (map->data == NULL) {
+        CloseHandle(mapping);
+        return 1;
+    }
+    map->handle = mapping;
+    return 0;
+}
+
+void unmapGif(struct GifMap *map)
+{
+    if (map->data != NULL)
+        UnmapViewOfFile(map->data);
+    if (map->handle != NULL)
+        CloseHandle(map->handle);
+    *map = (struct GifMap) { NULL, 0, 0, NULL };
+}
+#else
+static int mapFile(char const *filename, struct GifMap *map)
+{
+    struct stat st;
+    void *data;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd == -1)
+        return 1;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return 1;
+    }
+    map->size = (size_t)st.st_size;
+    if (map->size == 0) {
+        /* can't map empty files; the decoder will report a read failure */
+        close(fd);
+        return 0;
+    }
+    data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return 1;
+    map->data = data;
+    return 0;
+}
+
+void unmapGif(struct GifMap *map)
+{
+    if (map->data != NULL)
+        munmap((void *)map->data, map->size);
+    *map = (struct GifMap) { NULL, 0, 0, NULL };
+}
+#endif
+
+#ifndef COMPILE_GIFLIB
+/* giflib input callback, copying out of the mapping */
+static int readMapped(GifFileType *gifFile, GifByteType *buf, int len)
+{
+    struct GifMap *map = gifFile->UserData;
+    size_t avail = map->size - map->pos;
+    if ((size_t)len > avail)
+        len = (int)avail;
+    if (len > 0)
+        memcpy(buf, map->data + map->pos, len);
+    map->pos+= len;
+    return len;
+}
+#endif
+
+/* Offset of the decoder's next read in the mapping */
+static size_t tellMapped(GifFileType *gifFile)
+{
+#ifdef COMPILE_GIFLIB
+    size_t pos = 0;
+    DGifTellMem(gifFile, &pos);
+    return pos;
+#else
+    return ((struct GifMap *)gifFile->UserData)->pos;
+#endif
+}
+
+static int seekMapped(GifFileType *gifFile, size_t pos)
+{
+#ifdef COMPILE_GIFLIB
+    return DGifSeekMem(gifFile, pos);
+#else
+    ((struct GifMap *)gifFile->UserData)->pos = pos;
+    return GIF_OK;
+#endif
+}
+
+/* Open a decoder reading blocks in place from the mapping with the bundled
+ * giflib, or copying them out through readMapped otherwise.
+ */
+static GifFileType *openDecoder(struct GifMap *map, int *err)
+{
+#ifdef COMPILE_GIFLIB
+    return DGifOpenMem(map->data, map->size, err);
+#else
+    return DGifOpen(map, readMapped, err);
+#endif
+}
+
+GifFileType *openMappedGif(char const *filename, struct GifMap *map, int *err)
+{
+    GifFileType *gifFile;
+
+    *map = (struct GifMap) { NULL, 0, 0, NULL };
+    if (mapFile(filename, map) != 0) {
+        *err = D_GIF_ERR_OPEN_FAILED;
+        return NULL;
+    }
+
+    gifFile = openDecoder(map, err);
+    if (gifFile == NULL)
+        unmapGif(map);
+    return gifFile;
+}
+
+GifFileType *openMappedGifView(struct GifMap const *map, struct GifMap *view,
+        int *err)
+{
+    *view = (struct GifMap) { map->data, map->size, 0, NULL };
+    return openDecoder(view, err);
+}
+
+int indexGif(GifFileType *gifFile, struct GifFrameInfo **frames,
+        int *frameCt)
+{
+    struct GifFrameInfo frame;
+    GifRecordType recordType;
+    GifByteType *data;
+    int extCode, codeSize;
+    int frameCap = 0;
+    bool gcbSeen = false;
+
+    *frames = NULL;
+    *frameCt = 0;
+    frame.gcbErr = true;
+
+    do {
+        if (DGifGetRecordType(gifFile, &recordType) == GIF_ERROR)
+            goto fail;
+
+        switch (recordType) {
+        case IMAGE_DESC_RECORD_TYPE:
+            frame.descOffset = tellMapped(gifFile);
+            if (DGifGetImageDesc(gifFile) == GIF_ERROR)
+                goto fail;
+            frame.desc = gifFile->Image;
+            if (frame.desc.Width <= 0 || frame.desc.Height <= 0 ||
+                    frame.desc.Width > INT_MAX / frame.desc.Height)
+                goto fail;
+            if (frame.desc.ColorMap != NULL) {
+                frame.desc.ColorMap = GifMakeMapObject(
+                        frame.desc.ColorMap->ColorCount,
+                        frame.desc.ColorMap->Colors);
+                if (frame.desc.ColorMap == NULL)
+                    goto fail;
+            }
+            /* don't let descriptors pile up in gifFile->SavedImages */
+            GifFreeSavedImages(gifFile);
+            gifFile->ImageCount = 0;
+
+            if (*frameCt == frameCap) {
+                struct GifFrameInfo *grown;
+                frameCap = frameCap > 0 ? 2 * frameCap : 16;
+                grown = realloc(*frames, sizeof(**frames) * frameCap);
+                if (grown == NULL) {
+                    GifFreeMapObject(frame.desc.ColorMap);
+                    goto fail;
+                }
+                *frames = grown;
+            }
+            (*frames)[(*frameCt)++] = frame;
+
+            if (DGifGetCode(gifFile, &codeSize, &data) == GIF_ERROR)
+                goto fail;
+            while (data != NULL) {
+                if (DGifGetCodeNext(gifFile, &data) == GIF_ERROR)
+                    goto fail;
+            }
+            gcbSeen = false;
+            frame.gcbErr = true;
+            break;
+
+        case EXTENSION_RECORD_TYPE:
+            if (DGifGetExtension(gifFile, &extCode, &data) == GIF_ERROR)
+                goto fail;
+            if (extCode == GRAPHICS_EXT_FUNC_CODE && data != NULL &&
+                    !gcbSeen) {
+                gcbSeen = true;
+                frame.gcbErr = DGifExtensionToGCB(data[0], data + 1,
+                        &frame.gcb) == GIF_ERROR;
+            }
+            while (data != NULL) {
+                if (DGifGetExtensionNext(gifFile, &data) == GIF_ERROR)
+                    goto fail;
+            }
+            break;
+
+        default:
+            break;
+        }
+    } while (recordType != TERMINATE_RECORD_TYPE);
+
+    return GIF_OK;
+
+fail:
+    freeGifIndex(*frames, *frameCt);
+    *frames = NULL;
+    *frameCt = 0;
+    return GIF_ERROR;
+}
+
+void freeGifIndex(struct GifFrameInfo *frames, int frameCt)
+{
+    for (int i = 0; i < frameCt; i++)
+        GifFreeMapObject(frames[i].desc.ColorMap);
+    free(frames);
+}
+
+int readIndexedFrame(GifFileType *gifFile, struct GifFrameInfo const *frame,
+        uint8_t *raster)
+{
+    static const int interlacedOffsets[] = { 0, 4, 2, 1 };
+    static const int interlacedJumps[] = { 8, 8, 4, 2 };
+    int width = frame->desc.Width;
+    int height = frame->desc.Height;
+
+    if (seekMapped(gifFile, frame->descOffset) == GIF_ERROR ||
+            DGifGetImageDesc(gifFile) == GIF_ERROR)
+        return GIF_ERROR;
+    GifFreeSavedImages(gifFile);
+    gifFile->ImageCount = 0;
+    if (gifFile->Image.Width != width || gifFile->Image.Height != height)
+        return GIF_ERROR;
+
+    if (gifFile->Image.Interlace) {
+        for (int pass = 0; pass < 4; pass++)
+        for (int y = interlacedOffsets[pass]; y < height;
+                y+= interlacedJumps[pass]) {
+            if (DGifGetLine(gifFile, raster + y * width, width) == GIF_ERROR)
+                return GIF_ERROR;
+        }
+        return GIF_OK;
+    }
+    else {
+        return DGifGetLine(gifFile, raster, width * height);
+    }
+}
@@ -0,0 +1,103 @@
+/* gifmap.h -- Memory-mapped GIF input.
+ * version 0.2
+ * 
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ * 
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * For more information, please refer to <http://unlicense.org/>
+ */
+/* gifmap.h - Open GIF files for decoding straight out of a memory mapping,
+ * avoiding a read system call per data block, and index their frames so they
+ * can be decoded independently.
+ */
+#ifndef GIFMAP_H_
+#define GIFMAP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef COMPILE_GIFLIB
+#	include "giflib-5.1.9/gif_lib.h"
+#else
+#	include <gif_lib.h>
+#endif
+
+struct GifMap
+{
+    uint8_t const *data;
+    size_t size;
+    size_t pos;     /* read position when copying out of the mapping */
+    void *handle;   /* platform mapping handle, if any */
+};
+
+/* Map a GIF file into memory and open a decoder over the mapping.  With the
+ * bundled giflib the decoder reads data blocks in place, otherwise it copies
+ * them out of the mapping.
+ * map - Filled in with the mapping, which must outlive the decoder.
+ * err - Set to giflib error code on failure.
+ * Returns decoder, or NULL on failure.
+ */
+GifFileType *openMappedGif(char const *filename, struct GifMap *map, int *err);
+
+/* Unmap a GIF file after its decoder has been closed. */
+void unmapGif(struct GifMap *map);
+
+/* Open another decoder over an existing mapping, with its own read position.
+ * view - Filled in with the decoder's view of the mapping, which must outlive
+ *     the decoder.  It isn't a mapping of its own, so don't unmap it.
+ * Returns decoder, or NULL on failure.
+ */
+GifFileType *openMappedGifView(struct GifMap const *map, struct GifMap *view,
+        int *err);
+
+struct GifFrameInfo
+{
+    GifImageDesc desc;  /* ColorMap, if any, is owned by the index */
+    GraphicsControlBlock gcb;
+    bool gcbErr;        /* no graphics control block, or it was malformed */
+    size_t descOffset;  /* file offset of the image descriptor */
+};
+
+/* Walk the records of a GIF file, skipping over image data without decoding
+ * it, and record each frame's descriptor and graphics control block (the first
+ * one since the previous image).
+ * gifFile - Decoder opened by openMappedGif, positioned after the screen
+ *     descriptor.
+ * frames - Set to the allocated index, to be freed by freeGifIndex.
+ * Returns GIF_OK or GIF_ERROR.
+ */
+int indexGif(GifFileType *gifFile, struct GifFrameInfo **frames,
+        int *frameCt);
+
+void freeGifIndex(struct GifFrameInfo *frames, int frameCt);
+
+/* Decode the image whose descriptor is at frame->descOffset.
+ * gifFile - Decoder opened by openMappedGif or openMappedGifView.
+ * raster - Must have desc.Width * desc.Height bytes allocated.
+ * Returns GIF_OK or GIF_ERROR.
+ */
+int readIndexedFrame(GifFileType *gifFile, struct GifFrameInfo const *frame,
+        uint8_t *raster);
+
+#endif
@@ -32,6 +32,17 @@
 #include <stdint.h>
 #include <math.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+
+#ifdef _WIN32
+#	include <fcntl.h>
+#	include <io.h>
+#endif
+
+#ifdef __SSE2__
+#	include <emmintrin.h>
+#endif
 
 #ifdef COMPILE_GIFLIB
 #	include "giflib-5.1.9/gif_lib.h"
@@ -39,6 +50,8 @@
 #	include <gif_lib.h>
 #endif
 
+#include "gifdecoder.h"
+#include "gifmap.h"
 #include "sprite.h"
 
 #define FRAME_BORDER 2
@@ -89,6 +102,12 @@ static char *blendColorCode = NULL;
 static enum Spr_version version = SPR_VER_QUAKE; 
 static bool useDummyFrame = false;
 static bool extendFrames = false;
+static bool dedupFrames = false;
+static char *frameRangeOption = NULL;
+static char *intervalOption = NULL;
+static bool repaletteSprite = false;
+static bool transcodeSprite = false;
+static char *oldPalFileName = NULL;
 
 static struct Spr_color gradient
 (struct Spr_color color1, struct Spr_color color2, uint8_t value)
@@ -101,106 +120,130 @@ static struct Spr_color gradient
     return outColor;
 }
 
-static void blit
-(uint8_t *buffer, const uint8_t *frame, int bufW, int bufH,
- int frameW, int frameH, int left, int top, int transparent, int bgIndex)
+/* Number of opaque canvas pixels in each row and column, so the canvas's
+ * bounds can be found without scanning it.
+ */
+struct Occupancy {
+    int *rows;
+    int *cols;
+};
+
+static void clearOccupancy(struct Occupancy *occ, int bufW, int bufH)
+{
+    memset(occ->rows, 0, sizeof(*occ->rows) * bufH);
+    memset(occ->cols, 0, sizeof(*occ->cols) * bufW);
+}
+
+/* Draw a row of frame pixels onto the canvas.  Opaque pixels take their
+ * colors, already translated to the sprite palette; transparent pixels leave
+ * the canvas as is.  mask marks opaque canvas pixels with 0xff, and colCounts
+ * is updated for pixels that become opaque.
+ * Returns the number of pixels in the row that became opaque.
+ */
+static int blitSpan
+(uint8_t *dst, uint8_t *mask, const uint8_t *src, const uint8_t *colors,
+ int len, int transparent, int *colCounts)
 {
-    for (int fx = 0; fx < frameW; fx++)
-    for (int fy = 0; fy < frameH; fy++) {
-        int bx = left + fx;
-        int by = top + fy;
-
-        if (bx >= 0 && bx < bufW && by >= 0 && by < bufH) {
-            uint8_t color = frame[fx + frameW * fy];
-            if (color != transparent) {
-                buffer[bx + bufW * by] = color;
-            } else if (bgIndex >= 0) {
-                buffer[bx + bufW * by] = (uint8_t)bgIndex;
+    int delta = 0;
+    int x = 0;
+
+#ifdef __SSE2__
+    __m128i trans = _mm_set1_epi8((char)transparent);
+    for (; x + 16 <= len; x+= 16) {
+        __m128i isTrans = transparent < 0 ? _mm_setzero_si128() :
+            _mm_cmpeq_epi8(
+                    _mm_loadu_si128((const __m128i *)(src + x)), trans);
+        __m128i old = _mm_loadu_si128((const __m128i *)(dst + x));
+        __m128i oldMask = _mm_loadu_si128((const __m128i *)(mask + x));
+        __m128i color = _mm_loadu_si128((const __m128i *)(colors + x));
+        unsigned wasOpaque = _mm_movemask_epi8(oldMask);
+        unsigned isOpaque = wasOpaque |
+            (~(unsigned)_mm_movemask_epi8(isTrans) & 0xffff);
+        unsigned changed = wasOpaque ^ isOpaque;
+
+        _mm_storeu_si128((__m128i *)(dst + x),
+                _mm_or_si128(_mm_and_si128(isTrans, old),
+                    _mm_andnot_si128(isTrans, color)));
+        _mm_storeu_si128((__m128i *)(mask + x),
+                _mm_or_si128(oldMask,
+                    _mm_andnot_si128(isTrans, _mm_set1_epi8(-1))));
+        delta+= __builtin_popcount(changed);
+        for (; changed != 0; changed&= changed - 1)
+            colCounts[x + __builtin_ctz(changed)]++;
+    }
+#endif
+    for (; x < len; x++) {
+        if (src[x] != transparent) {
+            dst[x] = colors[x];
+            if (mask[x] == 0) {
+                mask[x] = 0xff;
+                colCounts[x]++;
+                delta++;
             }
         }
     }
+    return delta;
 }
 
-static void sampleRect
-(const uint8_t *buffer, uint8_t *rectRaster, int bufW, int bufH,
- struct Rect rect, int gifTrans, uint8_t sprTrans, uint8_t *lookup)
+/* Blit a frame onto the canvas, translating it to sprite palette indices
+ * through lookup, and keep the canvas's mask and occupancy counts.
+ * colors - Scratch row of at least bufW bytes.
+ */
+static void blit
+(uint8_t *buffer, uint8_t *mask, struct Occupancy *occ, uint8_t *colors,
+ const uint8_t *frame, int bufW, int bufH, int frameW, int frameH, int left,
+ int top, int transparent, const uint8_t *lookup)
 {
-    for (int rx = 0; rx < rect.width; rx++)
-    for (int ry = 0; ry < rect.height; ry++) {
-        int bx = rect.left + rx;
-        int by = rect.top + ry;
+    /* clip the frame to the canvas */
+    int x0 = left < 0 ? -left : 0;
+    int y0 = top < 0 ? -top : 0;
+    int x1 = bufW - left < frameW ? bufW - left : frameW;
+    int y1 = bufH - top < frameH ? bufH - top : frameH;
+
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    for (int fy = y0; fy < y1; fy++) {
+        const uint8_t *src = frame + x0 + (size_t)frameW * fy;
+        size_t offset = left + x0 + (size_t)bufW * (top + fy);
+
+        for (int x = 0; x < x1 - x0; x++)
+            colors[x] = lookup[src[x]];
+        occ->rows[top + fy]+= blitSpan(buffer + offset, mask + offset, src,
+                colors, x1 - x0, transparent, occ->cols + left + x0);
+    }
+}
 
-        if (bx >= 0 && bx < bufW && by >= 0 && by < bufH) {
-            uint8_t color = buffer[bx + bufW * by];
-            if (color == gifTrans) {
-                rectRaster[rx + rect.width * ry] = sprTrans;
-            }
-            else {
-                rectRaster[rx + rect.width * ry] = lookup[color];
-            }
-        }
-        else {
-            rectRaster[rx + rect.width * ry] = SPR_TRANS_IDX;
-        }
+/* Copy a rect of the canvas out to a raster of its own. */
+static void cropRect
+(const uint8_t *buffer, uint8_t *rectRaster, int bufW, struct Rect rect)
+{
+    for (int ry = 0; ry < rect.height; ry++) {
+        memcpy(rectRaster + (size_t)rect.width * ry,
+                buffer + rect.left + (size_t)bufW * (rect.top + ry),
+                rect.width);
     }
 }
 
+/* Find the bounds of the opaque pixels on the canvas, padded by border, from
+ * its occupancy counts.
+ */
 static struct Rect minRect
-(const uint8_t *buffer, int bufW, int bufH, int transparent, int border)
+(const struct Occupancy *occ, int bufW, int bufH, int border)
 {
     int left = 0;
     int right = bufW-1;
     int top = 0;
-    int bottom = bufW-1;
-    int x, y;
-    bool done = false;
+    int bottom = bufH-1;
 
-    x = left;
-    while (x < bufW && !done) {
-        for (y = 0; y < bufH && !done; y++) {
-            if (buffer[x + bufW * y] != transparent) {
-                left = x;
-                done = true;
-            }
-        }
-        x++;
-    }
-
-    done = false;
-    x = right;
-    while (x > left && !done) {
-        for (y = 0; y < bufH && !done; y++) {
-            if (buffer[x + bufW * y] != transparent) {
-                right = x;
-                done = true;
-            }
-        }
-        x--;
-    }
-
-    done = false;
-    y = top;
-    while (y < bufH && !done) {
-        for (x = left; x <= right && !done; x++) {
-            if (buffer[x + bufW * y] != transparent) {
-                top = y;
-                done = true;
-            }
-        }
-        y++;
-    }
-
-    done = false;
-    y = bottom;
-    while (y > top && !done) {
-        for (x = left; x <= right && !done; x++) {
-            if (buffer[x + bufW * y] != transparent) {
-                bottom = y;
-                done = true;
-            }
-        }
-        y--;
-    }
+    while (left < bufW && occ->cols[left] == 0)
+        left++;
+    while (right > left && occ->cols[right] == 0)
+        right--;
+    while (top < bufH && occ->rows[top] == 0)
+        top++;
+    while (bottom > top && occ->rows[bottom] == 0)
+        bottom--;
 
     struct Rect rect;
 
@@ -230,10 +273,270 @@ static struct Rect minRect
     return rect;
 }
 
+/* Intersection of a frame's rect with the canvas. */
+static struct Rect clipRect
+(int left, int top, int width, int height, int bufW, int bufH)
+{
+    int right = left + width < bufW ? left + width : bufW;
+    int bottom = top + height < bufH ? top + height : bufH;
+    struct Rect rect = { 0, 0, 0, 0, (void *)0 };
+
+    left = left < 0 ? 0 : left;
+    top = top < 0 ? 0 : top;
+    if (right > left && bottom > top) {
+        rect.width = right - left;
+        rect.height = bottom - top;
+        rect.left = left;
+        rect.top = top;
+    }
+    return rect;
+}
+
+static void fillRect(uint8_t *buffer, int bufW, struct Rect rect, uint8_t value)
+{
+    for (int y = rect.top; y < rect.top + rect.height; y++)
+        memset(buffer + rect.left + (size_t)bufW * y, value, rect.width);
+}
+
+/* Copy a rect between two canvas-sized buffers. */
+static void copyRect
+(uint8_t *dst, const uint8_t *src, int bufW, struct Rect rect)
+{
+    for (int y = rect.top; y < rect.top + rect.height; y++) {
+        size_t offset = rect.left + (size_t)bufW * y;
+        memcpy(dst + offset, src + offset, rect.width);
+    }
+}
+
+static uint32_t hashImage(const struct Spr_image *img)
+{
+    /* FNV-1a over offsets, size and raster */
+    int32_t header[4] = { img->offsetX, img->offsetY, img->width, img->height };
+    const uint8_t *bytes = (const uint8_t *)header;
+    size_t rasterSz = (size_t)img->width * img->height;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(header); i++) {
+        hash^= bytes[i];
+        hash*= 16777619u;
+    }
+    for (size_t i = 0; i < rasterSz; i++) {
+        hash^= img->raster[i];
+        hash*= 16777619u;
+    }
+    return hash;
+}
+
+static bool sameImage(const struct Spr_image *a, const struct Spr_image *b)
+{
+    return a->offsetX == b->offsetX && a->offsetY == b->offsetY &&
+        a->width == b->width && a->height == b->height &&
+        memcmp(a->raster, b->raster, (size_t)a->width * a->height) == 0;
+}
+
+/* Find images identical to the one before them.  When merging, each run of
+ * identical images is collapsed into its first, which gets the run's total
+ * delay; otherwise the repeats are listed on stderr.  Rasters belong to the
+ * sprite, so merged ones are just dropped.
+ * Returns the number of images left.
+ */
+static int dedupImages
+(struct Spr_image *images, float *delays, int imageCt, bool merge)
+{
+    int kept = 0;
+    int keptFrame = 0;
+    uint32_t keptHash = 0;
+
+    for (int i = 0; i < imageCt; i++) {
+        uint32_t hash = hashImage(images + i);
+        if (i > 0 && hash == keptHash &&
+                sameImage(images + kept - 1, images + i)) {
+            if (merge) {
+                delays[kept - 1]+= delays[i];
+                continue;
+            }
+            fprintf(stderr, "Frame %d repeats frame %d.\n", i + 1,
+                    keptFrame + 1);
+        }
+        else {
+            keptFrame = i;
+            keptHash = hash;
+        }
+        images[kept] = images[i];
+        delays[kept] = delays[i];
+        kept++;
+    }
+    return kept;
+}
+
+/* What becomes of each GIF frame, worked out from the index before anything
+ * is decoded.
+ */
+struct FramePlan {
+    int disposal;
+    int transIndex;
+    int delay;   /* hundredths of a second */
+    int showCt;  /* sprite frames showing this frame, 0 if it's dropped */
+    bool decode; /* false if nothing the frame draws is ever shown */
+};
+
+/* Plan frames 0 to last.  Frames before first are composited but not shown.
+ * With a nonzero interval (in hundredths) the range is resampled: each
+ * multiple of the interval shows whichever frame is up at that time, so
+ * frames shorter than the interval are merged into their neighbours or
+ * dropped.  Otherwise every frame in the range is shown once.
+ */
+static struct FramePlan *planFrames
+(const struct GifFrameInfo *frames, int first, int last, int interval,
+        int bufW, int bufH)
+{
+    struct FramePlan *plan = malloc(sizeof(*plan) * (last + 1));
+
+    for (int i = 0; i <= last; i++) {
+        if (frames[i].gcbErr) {
+            plan[i].disposal = DISPOSAL_UNSPECIFIED;
+            plan[i].transIndex = -1;
+            plan[i].delay = 8;
+        }
+        else {
+            plan[i].disposal = frames[i].gcb.DisposalMode;
+            plan[i].transIndex = frames[i].gcb.TransparentColor;
+            plan[i].delay = frames[i].gcb.DelayTime;
+        }
+        plan[i].showCt = interval == 0 && i >= first;
+    }
+
+    if (interval != 0) {
+        long total = 0;
+        for (int i = first; i <= last; i++)
+            total+= plan[i].delay;
+
+        long sampleCt = (total + interval - 1) / interval;
+        if (sampleCt > INT_MAX / 2) {
+            fputs("Interval is too short for the animation.\n", stderr);
+            exit(EXIT_FAILURE);
+        }
+        if (sampleCt == 0)
+            sampleCt = 1;
+
+        int shown = first;
+        long shownEnd = plan[first].delay;
+        for (long k = 0; k < sampleCt; k++) {
+            while (shown < last && shownEnd <= k * interval) {
+                shown++;
+                shownEnd+= plan[shown].delay;
+            }
+            plan[shown].showCt++;
+        }
+    }
+
+    /* A frame that isn't shown only matters for what it leaves on the canvas.
+     * Nothing is left if it's disposed to previous, or if the next frame
+     * clears the canvas or draws over all of it.  Skipped frames are skipped
+     * entirely, clear included, which is fine since the next frame wipes out
+     * whatever is there anyway. */
+    for (int i = 0; i <= last; i++) {
+        bool hidden = plan[i].disposal == DISPOSE_PREVIOUS;
+        if (!hidden && i < last && plan[i + 1].disposal != DISPOSE_PREVIOUS) {
+            const GifImageDesc *next = &frames[i + 1].desc;
+            hidden = plan[i + 1].disposal == DISPOSAL_UNSPECIFIED ||
+                plan[i + 1].disposal == DISPOSE_BACKGROUND ||
+                (plan[i + 1].transIndex < 0 && next->Left <= 0 &&
+                 next->Top <= 0 && next->Left + next->Width >= bufW &&
+                 next->Top + next->Height >= bufH);
+        }
+        plan[i].decode = plan[i].showCt > 0 || !hidden;
+    }
+
+    return plan;
+}
+
+/* Translations of GIF color maps to sprite palette indices, memoized by color
+ * map contents for the life of the process.  The sprite palette and blend mode
+ * are fixed per process, so a given color map always translates the same way.
+ */
+#define N_LOOKUP_BUCKETS 64
+
+struct ColorMapLookup {
+    uint32_t hash;
+    int colorCt;
+    GifColorType colors[SPR_MAX_PAL_SIZE];
+    uint8_t lookup[SPR_MAX_PAL_SIZE];
+    struct ColorMapLookup *next;
+};
+
+static struct ColorMapLookup *lookupBuckets[N_LOOKUP_BUCKETS];
+
+static uint32_t hashColorMap(const ColorMapObject *colorMap)
+{
+    /* FNV-1a */
+    const uint8_t *bytes = (const uint8_t *)colorMap->Colors;
+    size_t len = sizeof(*colorMap->Colors) * colorMap->ColorCount;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash^= bytes[i];
+        hash*= 16777619u;
+    }
+    return hash;
+}
+
+static const uint8_t *lookupColorMap
+(const ColorMapObject *colorMap, struct Spr_PalCache *palCache,
+ bool brightness)
+{
+    uint32_t hash = hashColorMap(colorMap);
+    int colorCt = colorMap->ColorCount;
+    struct ColorMapLookup **bucket = lookupBuckets + hash % N_LOOKUP_BUCKETS;
+    struct ColorMapLookup *entry;
+
+    if (colorCt > SPR_MAX_PAL_SIZE)
+        colorCt = SPR_MAX_PAL_SIZE;
+
+    for (entry = *bucket; entry != (void *)0; entry = entry->next) {
+        if (entry->hash == hash && entry->colorCt == colorCt &&
+                memcmp(entry->colors, colorMap->Colors,
+                    sizeof(*entry->colors) * colorCt) == 0) {
+            return entry->lookup;
+        }
+    }
+
+    entry = malloc(sizeof(*entry));
+    entry->hash = hash;
+    entry->colorCt = colorCt;
+    memcpy(entry->colors, colorMap->Colors, sizeof(*entry->colors) * colorCt);
+    /* indices outside the color map are invalid, but must map consistently */
+    memset(entry->lookup, 0, sizeof(entry->lookup));
+    for (int i = 0; i < colorCt; i++) {
+        struct Spr_color color;
+        color.rgb[0] = colorMap->Colors[i].Red;
+        color.rgb[1] = colorMap->Colors[i].Green;
+        color.rgb[2] = colorMap->Colors[i].Blue;
+        if (brightness) {
+            entry->lookup[i] = Spr_brightness(color);
+        }
+        else {
+            entry->lookup[i] = Spr_palCacheNearest(palCache, color);
+        }
+    }
+    entry->next = *bucket;
+    *bucket = entry;
+    return entry->lookup;
+}
+
+static void freeColorMapLookups(void)
+{
+    for (int i = 0; i < N_LOOKUP_BUCKETS; i++) {
+        while (lookupBuckets[i] != (void *)0) {
+            struct ColorMapLookup *next = lookupBuckets[i]->next;
+            free(lookupBuckets[i]);
+            lookupBuckets[i] = next;
+        }
+    }
+}
+
 static int loadArgs(int argc, char *argv[])
 {
     for (int i = 1; i < argc; i++) {
-        if (argv[i][0] == '-') {
+        if (argv[i][0] == '-' && argv[i][1] != '\0') {
             if (strcmp(argv[i], "-origin") == 0) {
                 i++;
                 if (i >= argc)
@@ -282,6 +585,35 @@ static int loadArgs(int argc, char *argv[])
                      strcmp(argv[i], "-e") == 0) {
                 extendFrames = true;
             }
+            else if (strcmp(argv[i], "-dedup") == 0) {
+                dedupFrames = true;
+            }
+            else if (strcmp(argv[i], "-repalette") == 0) {
+                repaletteSprite = true;
+            }
+            else if (strcmp(argv[i], "-transcode") == 0) {
+                transcodeSprite = true;
+            }
+            else if (strcmp(argv[i], "-oldpalette") == 0) {
+                i++;
+                if (i >= argc)
+                    return 11;
+                oldPalFileName = argv[i];
+            }
+            else if (strcmp(argv[i], "-frames") == 0 ||
+                     strcmp(argv[i], "-f") == 0) {
+                i++;
+                if (i >= argc)
+                    return 9;
+                frameRangeOption = argv[i];
+            }
+            else if (strcmp(argv[i], "-interval") == 0 ||
+                     strcmp(argv[i], "-i") == 0) {
+                i++;
+                if (i >= argc)
+                    return 10;
+                intervalOption = argv[i];
+            }
             else {
                 fprintf(stderr, "Unknown option \"%s\"\n", argv[i]);
                 return 6;
@@ -376,25 +708,276 @@ static struct Spr_color parseColor(const char *code) {
     return color;
 }
 
+/* Parse "FIRST[-LAST]", 1-based and inclusive, into 0-based frame indices.
+ * LAST may be left off after the dash to run to the final frame.
+ */
+static void parseFrameRange
+(const char *rangeString, int frameCt, int *first, int *last)
+{
+    const char *lastToken;
+    char *end;
+    long value;
+
+    *first = 0;
+    *last = frameCt - 1;
+    if (rangeString == NULL)
+        return;
+
+    errno = 0;
+    value = strtol(rangeString, &end, 10);
+    if (end == rangeString) {
+        fputs("First frame is not a number.\n", stderr);
+        exit(EXIT_FAILURE);
+    } else if (errno == ERANGE || value < 1 || value > frameCt)
+    {
+        fprintf(stderr, "First frame must be from 1 to %d.\n", frameCt);
+        exit(EXIT_FAILURE);
+    }
+    *first = (int)value - 1;
+
+    if (*end == '\0') {
+        *last = *first;
+        return;
+    } else if (*end != '-')
+    {
+        fputs("Frame range must be FIRST[-LAST].\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    lastToken = end + 1;
+    if (*lastToken == '\0')
+        return;
+
+    errno = 0;
+    value = strtol(lastToken, &end, 10);
+    if (end == lastToken || *end != '\0') {
+        fputs("Last frame is not a number.\n", stderr);
+        exit(EXIT_FAILURE);
+    } else if (errno == ERANGE || value < *first + 1 || value > frameCt)
+    {
+        fprintf(stderr, "Last frame must be from %d to %d.\n", *first + 1,
+                frameCt);
+        exit(EXIT_FAILURE);
+    }
+    *last = (int)value - 1;
+}
+
+/* Parse the resampling interval in seconds.  Returns it in hundredths of a
+ * second, the resolution of GIF delays, or 0 if there's no interval.
+ */
+static int parseInterval(const char *intervalString)
+{
+    char *end;
+    double seconds;
+
+    if (intervalString == NULL)
+        return 0;
+
+    errno = 0;
+    seconds = strtod(intervalString, &end);
+    if (end == intervalString || *end != '\0') {
+        fputs("Interval is not a number.\n", stderr);
+        exit(EXIT_FAILURE);
+    } else if (errno == ERANGE || isfinite(seconds) == 0 ||
+            seconds * 100 >= INT_MAX)
+    {
+        fputs("Interval is out of range.\n", stderr);
+        exit(EXIT_FAILURE);
+    } else if (round(seconds * 100) < 1)
+    {
+        fputs("Interval must be at least 0.01 seconds.\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+    return (int)round(seconds * 100);
+}
+
+static int parseBlendMode(const char *option)
+{
+    if (option == NULL)
+        return SPR_TEX_NORMAL;
+    for (int i = 0; i < N_BLENDMODES; i++) {
+        if (strcmp(option, BLENDMODE_NAMES[i]) == 0)
+            return i;
+    }
+    fprintf(stderr, "Unknown blend mode \"%s\"\n", option);
+    exit(EXIT_FAILURE);
+}
+
+/* Write a whole sprite to a file, or to standard output for "-". */
+static void writeSprite(struct Spr_Sprite *sprite, const char *fileName)
+{
+    if (strcmp(fileName, "-") == 0) {
+        /* standard output is descriptor 1 everywhere */
+#ifdef _WIN32
+        _setmode(1, _O_BINARY);
+#endif
+        fflush(stdout);
+        Spr_writeSink(sprite, Spr_fdSink(1), "<stdout>", sprFatalError);
+    }
+    else {
+        Spr_write(sprite, fileName, sprFatalError);
+    }
+}
+
+/* Convert an existing sprite to the other engine's format.  Quake sprites
+ * take the Quake (or -palette) palette along into HL, alpha-tested unless
+ * -blendmode says otherwise; HL sprites are mapped to it, with single frames
+ * shown for the -interval, or 0.1 seconds.
+ */
+static int transcode(char const *inName, char const *outName)
+{
+    static struct Spr_color colors[SPR_Q_PAL_SIZE];
+    struct Spr_View *view;
+    struct Spr_Sprite *sprite;
+    /* Quake's index 255 is transparent, which HL only honors when alpha
+     * testing */
+    int blendMode = blendModeOption != (void *)0 ?
+            parseBlendMode(blendModeOption) : SPR_TEX_ALPHA_TEST;
+    int interval = parseInterval(intervalOption);
+
+    if (blendMode == SPR_TEX_INDEX_ALPHA) {
+        fputs("Can't transcode to index-alpha; its indices are alpha, not "
+                "colors.\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    if (palFileName != (void *)0)
+        Spr_readPalette(palFileName, colors, sprFatalError);
+    else
+        Spr_defaultQPalette(colors);
+
+    view = Spr_map(inName, sprFatalError);
+    if (Spr_viewInfo(view)->version == SPR_VER_HL &&
+            Spr_viewInfo(view)->texType == SPR_TEX_INDEX_ALPHA) {
+        fprintf(stderr, "%s: Can't transcode from index-alpha; its indices "
+                "are alpha, not colors.\n", inName);
+        exit(EXIT_FAILURE);
+    }
+    sprite = Spr_transcode(view, blendMode, SPR_Q_PAL_SIZE, colors,
+            interval != 0 ? interval * 0.01f : 0.1f);
+    writeSprite(sprite, outName);
+    Spr_free(sprite);
+    Spr_freeView(view);
+    return EXIT_SUCCESS;
+}
+
+/* Remap an existing Quake sprite from the palette it was made with to the one
+ * given by -palette.  Only raster bytes change; the file is otherwise copied
+ * byte for byte.
+ */
+static int repalette(char const *inName, char const *outName)
+{
+    static struct Spr_color oldColors[SPR_Q_PAL_SIZE];
+    static struct Spr_color newColors[SPR_Q_PAL_SIZE];
+    uint8_t lookup[SPR_MAX_PAL_SIZE];
+    struct Spr_View *view;
+    uint8_t *data;
+    long size;
+    FILE *file;
+
+    if (oldPalFileName != (void *)0)
+        Spr_readPalette(oldPalFileName, oldColors, sprFatalError);
+    else
+        Spr_defaultQPalette(oldColors);
+    if (palFileName != (void *)0)
+        Spr_readPalette(palFileName, newColors, sprFatalError);
+    else
+        Spr_defaultQPalette(newColors);
+
+    /* read into memory of our own, so rasters can be rewritten in place */
+    file = fopen(inName, "rb");
+    if (file == (void *)0) {
+        fprintf(stderr, "%s: Failed to open file.\n", inName);
+        exit(EXIT_FAILURE);
+    }
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0 ||
+            fseek(file, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "%s: Read failure.\n", inName);
+        exit(EXIT_FAILURE);
+    }
+    data = malloc(size > 0 ? size : 1);
+    if (data == (void *)0) {
+        fputs("Out of memory.\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+    if (fread(data, 1, size, file) < (size_t)size) {
+        fprintf(stderr, "%s: Read failure.\n", inName);
+        exit(EXIT_FAILURE);
+    }
+    fclose(file);
+
+    view = Spr_read(data, size, inName, sprFatalError);
+    if (Spr_viewInfo(view)->version != SPR_VER_QUAKE) {
+        fprintf(stderr, "%s: HL sprites carry their own palette.\n", inName);
+        exit(EXIT_FAILURE);
+    }
+
+    Spr_paletteTranslation(SPR_Q_PAL_SIZE, oldColors, SPR_Q_PAL_SIZE,
+            newColors, true, lookup);
+    Spr_translateView(view, data, lookup, sprFatalError);
+    Spr_freeView(view);
+
+    if (strcmp(outName, "-") == 0) {
+#ifdef _WIN32
+        _setmode(1, _O_BINARY);
+#endif
+        file = stdout;
+    }
+    else {
+        file = fopen(outName, "wb");
+    }
+    if (file == (void *)0) {
+        fprintf(stderr, "%s: Failed to open file.\n", outName);
+        exit(EXIT_FAILURE);
+    }
+    if (fwrite(data, 1, size, file) < (size_t)size || fclose(file) != 0) {
+        fprintf(stderr, "%s: Write failure.\n", outName);
+        exit(EXIT_FAILURE);
+    }
+    free(data);
+    return EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[])
 {
     int err; /* gif error code */
     GifFileType *gifFile; /* GIF data read/decoded from file */
+    struct GifMap gifMap; /* GIF file mapped into memory */
+    struct GifFrameInfo *gifFrames; /* index of frames in the GIF file */
+    struct GifFrameInfo *decodeFrames; /* just the frames to be decoded */
+    struct FramePlan *framePlan;
+    struct GifDecoder *decoder;
     ColorMapObject *gifColorMap;
+    int frameCt;
+    int firstFrame;
+    int lastFrame;
+    int interval; /* hundredths of a second, 0 to keep the GIF's timing */
+    int decodeCt;
+    int imageCt;
+    int imageCap;
     struct Spr_Sprite *sprite;
+    struct Spr_Writer *writer = (void *)0; /* set when streaming frames out */
+    uint8_t *cropBuffer = (void *)0;
+    struct Spr_PalCache *palCache;
     uint16_t colorCt; /* number of colors */
     static struct Spr_color colors[SPR_MAX_PAL_SIZE];
     struct Spr_image *images;
     float *delays;
     struct DVec2D origin;
     int alignment = -1;
-    int blendMode = -1;
+    int blendMode;
     struct Spr_color blendColor;
-    static uint8_t paletteLookup[SPR_MAX_PAL_SIZE];
-    uint8_t *imgBuffer;
+    const uint8_t *paletteLookup;
+    uint8_t *imgBuffer; /* canvas, in sprite palette indices */
+    uint8_t *imgMask; /* 0xff where the canvas is opaque */
+    uint8_t *rowColors; /* scratch row for blit */
     uint8_t *prevBuffer;
+    uint8_t *prevMask;
+    uint8_t sprTransIndex;
     size_t canvasPixCount;
-    uint8_t gifBgIndex = 0;
+    struct Occupancy occupancy;
+    struct Occupancy prevOccupancy;
+    struct Rect frameRect; /* current frame's rect, clipped to the canvas */
 
     int loadErr = loadArgs(argc, argv);
 
@@ -407,7 +990,15 @@ int main(int argc, char *argv[])
                 "[-origin X,Y]\n", stderr);
         fputs("       [-quake] [-hl] [-b|-blendmode BLENDMODE] [-c|-color CODE]"
                 " [-d|-dummy]\n", stderr);
-        fputs("       [-e|-extend] GIFFILE SPRFILE\n\n", stderr);
+        fputs("       [-e|-extend] [-dedup] [-f|-frames FIRST[-LAST]]"
+                " [-i|-interval SECONDS]\n", stderr);
+        fputs("       GIFFILE SPRFILE\n", stderr);
+        fputs("       gif2spr -repalette [-oldpalette OLDPALFILE] "
+                "[-p|-palette PALFILE]\n"
+              "       SPRFILE NEWSPRFILE\n", stderr);
+        fputs("       gif2spr -transcode [-p|-palette PALFILE] "
+                "[-b|-blendmode BLENDMODE]\n"
+              "       [-i|-interval SECONDS] SPRFILE NEWSPRFILE\n\n", stderr);
         fputs("    ALIGNMENT Sprite orientation. Options "
                 "(defaults to vp-parallel):\n", stderr);
         for (int i = 0; i < N_ALIGNMENTS; i++)
@@ -429,12 +1020,35 @@ int main(int argc, char *argv[])
         fputs("    -hl       Write sprite in Half-Life format.\n", stderr);
         fputs("    -dummy    (HL) Append an empty \"dummy\" frame.\n", stderr);
         fputs("    -extend   Extend frame boundaries to image size.\n", stderr);
+        fputs("    -dedup    Merge repeated frames, adding up their delays. HL\n"
+              "              sprites have no delays, so repeats are only "
+                "listed.\n", stderr);
+        fputs("    FIRST     First GIF frame to convert, from 1.\n", stderr);
+        fputs("    LAST      Last GIF frame to convert. Defaults to FIRST, or "
+                "the final\n"
+              "              frame if the dash is given.\n", stderr);
+        fputs("    SECONDS   Resample to one frame per SECONDS, dropping "
+                "frames that\n"
+              "              aren't up at any sample.\n", stderr);
+        fputs("    -repalette Remap a Quake sprite made with OLDPALFILE to "
+                "PALFILE.\n", stderr);
+        fputs("    OLDPALFILE Palette lump. Defaults to Quake palette.\n",
+                stderr);
+        fputs("    -transcode Convert a Quake sprite to HL, or HL to Quake. "
+                "BLENDMODE\n"
+              "              defaults to alpha-test.\n", stderr);
         fputs("    GIFFILE   Input GIF file.\n", stderr);
-        fputs("    SPRFILE   Output SPRITE file.\n", stderr);
+        fputs("    SPRFILE   Output SPRITE file, or - for standard output.\n",
+                stderr);
         exit(EXIT_FAILURE);
     }
 
-    gifFile = DGifOpenFileName(gifFileName, &err);
+    if (repaletteSprite)
+        return repalette(gifFileName, sprFileName);
+    if (transcodeSprite)
+        return transcode(gifFileName, sprFileName);
+
+    gifFile = openMappedGif(gifFileName, &gifMap, &err);
 
     if (gifFile == (void *)0) {
         fprintf(stderr, "%s:\n", gifFileName);
@@ -442,7 +1056,9 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
     
-    if (DGifSlurp(gifFile) == GIF_ERROR) {
+    /* index the frames up front so they can be decoded in parallel */
+    if (indexGif(gifFile, &gifFrames, &frameCt) == GIF_ERROR ||
+            frameCt == 0) {
         fprintf(stderr, "%s:\n", gifFileName);
         fputs("Failed to load file.\n", stderr);
         exit(EXIT_FAILURE);
@@ -450,23 +1066,15 @@ int main(int argc, char *argv[])
 
     /* try to use global color map, use 1st frame's if global is null */
     gifColorMap = gifFile->SColorMap;
+    if (gifColorMap == (void *)0)
+        gifColorMap = gifFrames[0].desc.ColorMap;
     if (gifColorMap == (void *)0) {
-        gifColorMap = gifFile->SavedImages[0].ImageDesc.ColorMap;
+        fprintf(stderr, "%s:\n", gifFileName);
+        fputs("No color map.\n", stderr);
+        exit(EXIT_FAILURE);
     }
 
-    if (blendModeOption == (void *)0) {
-        blendMode = SPR_TEX_NORMAL;
-    }
-    else {
-        for ( int i = 0; i < N_BLENDMODES && blendMode == -1; i++) {
-            if (strcmp(blendModeOption, BLENDMODE_NAMES[i]) == 0)
-                blendMode = i;
-        }
-        if (blendMode == -1) {
-            fprintf(stderr, "Unknown blend mode \"%s\"\n", blendModeOption);
-            exit(EXIT_FAILURE);
-        }
-    }
+    blendMode = parseBlendMode(blendModeOption);
 
     if (blendColorCode == (void *)0) {
         blendColor = (struct Spr_color) {{ 255, 255, 255 }};
@@ -540,117 +1148,231 @@ int main(int argc, char *argv[])
             colors,
             (int32_t)floor(  -origin.x  * gifFile->SWidth),
             (int32_t)floor((1-origin.y) * gifFile->SHeight) );
+    palCache = Spr_newPalCache(colorCt, colors);
 
     canvasPixCount = gifFile->SWidth * gifFile->SHeight;
     imgBuffer = malloc(canvasPixCount);
+    imgMask = malloc(canvasPixCount);
+    rowColors = malloc(gifFile->SWidth);
     prevBuffer = malloc(canvasPixCount);
+    prevMask = malloc(canvasPixCount);
+    occupancy.rows = malloc(sizeof(int) * gifFile->SHeight);
+    occupancy.cols = malloc(sizeof(int) * gifFile->SWidth);
+    prevOccupancy.rows = malloc(sizeof(int) * gifFile->SHeight);
+    prevOccupancy.cols = malloc(sizeof(int) * gifFile->SWidth);
+    if (imgBuffer == (void *)0 || imgMask == (void *)0 ||
+            rowColors == (void *)0 || prevBuffer == (void *)0 ||
+            prevMask == (void *)0 || occupancy.rows == (void *)0 ||
+            occupancy.cols == (void *)0 || prevOccupancy.rows == (void *)0 ||
+            prevOccupancy.cols == (void *)0) {
+        fputs("Out of memory.\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    /* frames are translated to sprite palette indices as they're drawn, so
+     * transparent canvas pixels hold the sprite's transparent index */
+    sprTransIndex = blendMode == SPR_TEX_INDEX_ALPHA ? 0 : SPR_TRANS_IDX;
+    memset(imgBuffer, sprTransIndex, canvasPixCount);
+    memset(imgMask, 0, canvasPixCount);
+    clearOccupancy(&occupancy, gifFile->SWidth, gifFile->SHeight);
+
+    parseFrameRange(frameRangeOption, frameCt, &firstFrame, &lastFrame);
+    interval = parseInterval(intervalOption);
+    framePlan = planFrames(gifFrames, firstFrame, lastFrame, interval,
+            gifFile->SWidth, gifFile->SHeight);
+
+    /* frames whose drawing is never shown aren't decoded at all; the index
+     * already stepped over their image data without decompressing it */
+    decodeFrames = malloc(sizeof(*decodeFrames) * (lastFrame + 1));
+    decodeCt = 0;
+    imageCap = 0;
+    for (int i = 0; i <= lastFrame; i++) {
+        if (framePlan[i].decode)
+            decodeFrames[decodeCt++] = gifFrames[i];
+        if (interval != 0 && version == SPR_VER_QUAKE)
+            imageCap+= framePlan[i].showCt > 0;
+        else
+            imageCap+= framePlan[i].showCt;
+    }
+
+    /* start decoding before any output file exists, so failing here leaves
+     * nothing behind */
+    decoder = newGifDecoder(&gifMap, decodeFrames, decodeCt, 0);
+    if (decoder == (void *)0) {
+        fputs("Failed to start decoder.\n", stderr);
+        exit(EXIT_FAILURE);
+    }
 
-    images = malloc(sizeof(*images) * gifFile->ImageCount);
-    delays = malloc(sizeof(*delays) * gifFile->ImageCount);
+    /* Frames are written out as they're made, so memory use doesn't grow with
+     * the animation.  That can't work if repeats have to be found first, or
+     * for standard output, which can't be seeked back to fill in counts. */
+    if (!dedupFrames && strcmp(sprFileName, "-") != 0) {
+        writer = Spr_newWriter(sprite, sprFileName, sprFatalError);
+        cropBuffer = malloc(canvasPixCount);
+        images = (void *)0;
+        delays = (void *)0;
+        if (version == SPR_VER_QUAKE)
+            Spr_beginGroupFrame(writer, imageCap);
+    }
+    else {
+        /* frames are built in the sprite's own storage, then handed over */
+        Spr_reserve(sprite, version == SPR_VER_QUAKE ? 1 : imageCap + 1,
+                (sizeof(*images) + sizeof(*delays)) * imageCap);
+        images = Spr_alloc(sprite, sizeof(*images) * imageCap);
+        delays = Spr_alloc(sprite, sizeof(*delays) * imageCap);
+    }
+    imageCt = 0;
 
-    for (int i = 0; i < gifFile->ImageCount; i++) {
-        SavedImage gifImage = gifFile->SavedImages[i];
-        GifImageDesc imgDesc = gifImage.ImageDesc;
-        GraphicsControlBlock gcb;
+    for (int i = 0, decodeIdx = 0; i <= lastFrame; i++) {
+        GifImageDesc imgDesc = gifFrames[i].desc;
         ColorMapObject *localColorMap = imgDesc.ColorMap;
-        int gifTransIndex;
-        int gifDelay;
-        int disposal;
+        const uint8_t *frameRaster;
+        int gifTransIndex = framePlan[i].transIndex;
+        int disposal = framePlan[i].disposal;
+
+        if (!framePlan[i].decode)
+            continue;
+
+        /* frames decode in parallel, but are composited in order */
+        frameRaster = gifDecoderTake(decoder, decodeIdx);
+        if (frameRaster == (void *)0) {
+            fprintf(stderr, "%s:\n", gifFileName);
+            fputs("Failed to load file.\n", stderr);
+            if (writer != (void *)0)
+                remove(sprFileName);
+            exit(EXIT_FAILURE);
+        }
 
         if (localColorMap == (void *)0)
             localColorMap = gifColorMap;
 
-        for (int i = 0; i < localColorMap->ColorCount; i++) {
-            struct Spr_color color;
-            color.rgb[0] = localColorMap->Colors[i].Red;
-            color.rgb[1] = localColorMap->Colors[i].Green;
-            color.rgb[2] = localColorMap->Colors[i].Blue;
-            if (version == SPR_VER_HL && blendMode == SPR_TEX_INDEX_ALPHA) {
-                paletteLookup[i] = Spr_brightness(color);
-            }
-            else {
-                paletteLookup[i] = Spr_nearestIndex(sprite, color);
-            }
-        }
+        paletteLookup = lookupColorMap(localColorMap, palCache,
+                version == SPR_VER_HL && blendMode == SPR_TEX_INDEX_ALPHA);
 
+        /* only the frame's own rect changes, so that's all that needs to be
+         * saved for DISPOSE_PREVIOUS */
+        frameRect = clipRect(imgDesc.Left, imgDesc.Top, imgDesc.Width,
+                imgDesc.Height, gifFile->SWidth, gifFile->SHeight);
 
-        if (DGifSavedExtensionToGCB(gifFile, i, &gcb) == GIF_ERROR) {
-            gifTransIndex = -1;
-            disposal = DISPOSAL_UNSPECIFIED;
-            gifDelay = 8;
+        if (disposal == DISPOSAL_UNSPECIFIED ||
+                disposal == DISPOSE_BACKGROUND) {
+            /* Seems GIMP and browsers treat background as transparent.
+             * The canvas is already transparent outside the occupied rect. */
+            struct Rect occupied = minRect(&occupancy, gifFile->SWidth,
+                    gifFile->SHeight, 0);
+            fillRect(imgBuffer, gifFile->SWidth, occupied, sprTransIndex);
+            fillRect(imgMask, gifFile->SWidth, occupied, 0);
+            clearOccupancy(&occupancy, gifFile->SWidth, gifFile->SHeight);
         }
-        else {
-            gifTransIndex = gcb.TransparentColor;
-            disposal = gcb.DisposalMode;
-            gifDelay = gcb.DelayTime;
+
+        if (disposal == DISPOSE_PREVIOUS) {
+            copyRect(prevBuffer, imgBuffer, gifFile->SWidth, frameRect);
+            copyRect(prevMask, imgMask, gifFile->SWidth, frameRect);
+            memcpy(prevOccupancy.rows, occupancy.rows,
+                    sizeof(int) * gifFile->SHeight);
+            memcpy(prevOccupancy.cols, occupancy.cols,
+                    sizeof(int) * gifFile->SWidth);
         }
 
-        /* Seems GIMP and browsers treat background as transparent */
-        gifBgIndex = gifTransIndex;
-        delays[i] = gifDelay * 0.01; /* convert to seconds */
+        blit(imgBuffer, imgMask, &occupancy, rowColors, frameRaster,
+                gifFile->SWidth, gifFile->SHeight, imgDesc.Width,
+                imgDesc.Height, imgDesc.Left, imgDesc.Top, gifTransIndex,
+                paletteLookup);
 
-        if (i == 0 || disposal == DISPOSAL_UNSPECIFIED ||
-                disposal == DISPOSE_BACKGROUND) {
-            if (disposal == DISPOSE_BACKGROUND) {
-                memset(imgBuffer, gifBgIndex, canvasPixCount);
+        if (framePlan[i].showCt > 0) {
+            int copies = framePlan[i].showCt;
+            float delay = framePlan[i].delay * 0.01; /* convert to seconds */
+            struct Rect rect;
+
+            if (interval != 0 && version == SPR_VER_QUAKE) {
+                /* a group frame can just be held for the samples instead */
+                delay = copies * interval * 0.01;
+                copies = 1;
+            }
+
+            if (extendFrames) {
+                rect.left = 0;
+                rect.top = 0;
+                rect.width = gifFile->SWidth;
+                rect.height = gifFile->SHeight;
             }
             else {
-                memset(imgBuffer, gifTransIndex, canvasPixCount);
+                rect = minRect(&occupancy, gifFile->SWidth, gifFile->SHeight,
+                    FRAME_BORDER);
+            }
+
+            for (int n = 0; n < copies; n++) {
+                struct Spr_image image;
+                image.offsetX =  rect.left;
+                image.offsetY = -rect.top;
+                image.width  = rect.width;
+                image.height = rect.height;
+                if (writer != (void *)0)
+                    image.raster = cropBuffer;
+                else
+                    image.raster = Spr_alloc(sprite, rect.width * rect.height);
+                cropRect(imgBuffer, image.raster, gifFile->SWidth, rect);
+
+                if (writer == (void *)0) {
+                    images[imageCt] = image;
+                    delays[imageCt] = delay;
+                }
+                else if (version == SPR_VER_QUAKE) {
+                    Spr_writeGroupImage(writer, delay, &image);
+                }
+                else {
+                    Spr_writeSingleFrame(writer, &image);
+                }
+                imageCt++;
             }
         }
 
         if (disposal == DISPOSE_PREVIOUS) {
-            memcpy(prevBuffer, imgBuffer, canvasPixCount);
+            struct Occupancy restored = prevOccupancy;
+            copyRect(imgBuffer, prevBuffer, gifFile->SWidth, frameRect);
+            copyRect(imgMask, prevMask, gifFile->SWidth, frameRect);
+            prevOccupancy = occupancy;
+            occupancy = restored;
         }
 
-        blit(imgBuffer, gifImage.RasterBits, gifFile->SWidth, gifFile->SHeight,
-                imgDesc.Width, imgDesc.Height, imgDesc.Left, imgDesc.Top,
-                gifTransIndex,
-                disposal == DISPOSE_BACKGROUND ? gifBgIndex : -1);
-
-        struct Rect rect;
-        if (extendFrames) {
-            rect.left = 0;
-            rect.top = 0;
-            rect.width = gifFile->SWidth;
-            rect.height = gifFile->SHeight;
-        }
-        else {
-            rect = minRect(imgBuffer, gifFile->SWidth, gifFile->SHeight,
-                gifTransIndex, FRAME_BORDER);
-        }
+        gifDecoderRelease(decoder, decodeIdx);
+        decodeIdx++;
+    }
 
-        images[i].offsetX =  rect.left;
-        images[i].offsetY = -rect.top;
-        images[i].width  = rect.width;
-        images[i].height = rect.height;
-        images[i].raster = malloc(rect.width * rect.height);
+    freeGifDecoder(decoder);
+    free(decodeFrames);
+    free(framePlan);
+    freeGifIndex(gifFrames, frameCt);
+    free(imgBuffer);
+    free(imgMask);
+    free(rowColors);
+    free(prevBuffer);
+    free(prevMask);
+    free(occupancy.rows);
+    free(occupancy.cols);
+    free(prevOccupancy.rows);
+    free(prevOccupancy.cols);
+    Spr_freePalCache(palCache);
+    freeColorMapLookups();
+
+    if (dedupFrames) {
+        imageCt = dedupImages(images, delays, imageCt,
+                version == SPR_VER_QUAKE);
+    }
 
-        if (blendMode == SPR_TEX_INDEX_ALPHA) {
-            sampleRect(imgBuffer, images[i].raster, gifFile->SWidth,
-                    gifFile->SHeight, rect, gifTransIndex, 0, paletteLookup);
+    /* everything was allocated from the sprite, so nothing is copied */
+    if (writer == (void *)0) {
+        if (version == SPR_VER_QUAKE) {
+            Spr_takeGroupFrame(sprite, delays, images, imageCt);
         }
         else {
-            sampleRect(imgBuffer, images[i].raster, gifFile->SWidth,
-                    gifFile->SHeight, rect, gifTransIndex, SPR_TRANS_IDX,
-                    paletteLookup);
-        }
-
-        if (disposal == DISPOSE_PREVIOUS) {
-            memcpy(imgBuffer, prevBuffer, canvasPixCount);
+            for (int i = 0; i < imageCt; i++) {
+                Spr_takeSingleFrame(sprite, images + i);
+            }
         }
     }
 
-    free(imgBuffer);
-    free(prevBuffer);
-
-    if (version == SPR_VER_QUAKE) {
-        Spr_appendGroupFrame(sprite, delays, images, gifFile->ImageCount);
-    }
-    else {
-        for (int i = 0; i < gifFile->ImageCount; i++) {
-            Spr_appendSingleFrame(sprite, images + i);
-        }
+    if (version == SPR_VER_HL) {
         if (useDummyFrame) {
             struct Spr_image dummy;
             dummy.offsetX = 0;
@@ -663,29 +1385,33 @@ int main(int argc, char *argv[])
                 dummy.width = 0;
                 dummy.height = 0;
             }
-            dummy.raster = malloc(dummy.width * dummy.height);
+            dummy.raster = Spr_alloc(sprite, dummy.width * dummy.height);
             if (blendMode == SPR_TEX_INDEX_ALPHA) {
                 memset(dummy.raster, 0, dummy.width * dummy.height);
             }
             else {
                 memset(dummy.raster, SPR_TRANS_IDX, dummy.width * dummy.height);
             }
-            Spr_appendSingleFrame(sprite, &dummy);
-            free(dummy.raster);
+            if (writer != (void *)0)
+                Spr_writeSingleFrame(writer, &dummy);
+            else
+                Spr_takeSingleFrame(sprite, &dummy);
         }
     }
 
-    free(delays);
-    for (size_t i = 0; i < gifFile->ImageCount; i++)
-        free(images[i].raster);
-    free(images);
-
     if (DGifCloseFile(gifFile, &err) != GIF_OK) {
         fprintf(stderr, "%s:\n", gifFileName);
         fprintf(stderr, "%s.\n", GifErrorString(err));
     }
+    unmapGif(&gifMap);
 
-    Spr_write(sprite, sprFileName, sprFatalError);
+    if (writer != (void *)0) {
+        Spr_closeWriter(writer);
+        free(cropBuffer);
+    }
+    else {
+        writeSprite(sprite, sprFileName);
+    }
     Spr_free(sprite);
 
 
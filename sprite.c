@@ -26,6 +26,10 @@
  * 
  * For more information, please refer to <http://unlicense.org/>
  */
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#   define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "sprite.h"
 
 #include <stdio.h>
@@ -34,9 +38,27 @@
 #include <math.h>
 #include <float.h>
 #include <limits.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#   include <io.h>
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <sys/uio.h>
+#   include <unistd.h>
+#endif
 
 #include "quakepal.h"
 
+#if (defined(__GNUC__) || defined(__clang__)) && \
+        (defined(__x86_64__) || defined(__i386__))
+#   define SPR_X86_SIMD
+#   include <immintrin.h>
+#endif
+
 int32_t const FRAME_SINGLE = 0;
 int32_t const FRAME_GROUP = 1;
 
@@ -83,20 +105,83 @@ union frame
     struct groupFrame group;
 };
 
+/* Bump allocator holding everything a sprite owns, so it's all released at
+ * once.  Chunks at least double in size as they're added, and nothing is freed
+ * on its own.
+ */
+#define ARENA_MIN_CHUNK 65536
+#define ARENA_ALIGN 16
+
+struct arenaChunk
+{
+    struct arenaChunk *prev;
+    size_t size;
+    size_t used;
+};
+
+#define CHUNK_HEADER_SZ \
+    ((sizeof(struct arenaChunk) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+struct arena
+{
+    struct arenaChunk *chunk; /* newest chunk, the only one allocated from */
+};
+
 struct Spr_Sprite
 {
+    struct arena arena;
     struct header *header;
     struct Spr_palette palette;
     union frame *frames;
+    int32_t frameCap;
     int32_t offsetX;
     int32_t offsetY;
 };
 
 /* Functions */
 
+/* make sure size more bytes fit in the newest chunk */
+static void arenaReserve(struct arena *arena, size_t size)
+{
+    struct arenaChunk *chunk = arena->chunk;
+    size_t chunkSz;
+
+    if (chunk != NULL && chunk->size - chunk->used >= size)
+        return;
+
+    chunkSz = chunk == NULL ? ARENA_MIN_CHUNK : chunk->size * 2;
+    if (chunkSz < size)
+        chunkSz = size;
+    chunk = malloc(CHUNK_HEADER_SZ + chunkSz);
+    *chunk = (struct arenaChunk) { arena->chunk, chunkSz, 0 };
+    arena->chunk = chunk;
+}
+
+static void *arenaAlloc(struct arena *arena, size_t size)
+{
+    void *ptr;
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    arenaReserve(arena, size);
+    ptr = (char *)arena->chunk + CHUNK_HEADER_SZ + arena->chunk->used;
+    arena->chunk->used+= size;
+    return ptr;
+}
+
+static void arenaFree(struct arena *arena)
+{
+    struct arenaChunk *chunk = arena->chunk;
+    while (chunk != NULL) {
+        struct arenaChunk *prev = chunk->prev;
+        free(chunk);
+        chunk = prev;
+    }
+}
+
 float dist(int32_t dx, int32_t dy)
 {
-    return sqrtf(dx*dx + dy*dy);
+    /* 64-bit, since sizes may come from untrusted sprite files */
+    int64_t sq = (int64_t)dx * dx + (int64_t)dy * dy;
+    return sqrtf((float)sq);
 }
 
 struct Spr_Sprite *Spr_new(
@@ -111,6 +196,7 @@ struct Spr_Sprite *Spr_new(
         int32_t offsetX,
         int32_t offsetY)
 {
+    struct arena arena = { NULL };
     struct header *header;
     struct Spr_Sprite *sprite;
     int32_t dx = offsetX, dy = offsetY;
@@ -122,7 +208,9 @@ struct Spr_Sprite *Spr_new(
     if (2*offsetY < maxHeight)
         dy+= maxHeight;
 
-    header = malloc(sizeof(*header));
+    /* the sprite lives in its own arena */
+    sprite = arenaAlloc(&arena, sizeof(*sprite));
+    header = arenaAlloc(&arena, sizeof(*header));
     *header = (struct header) {
         .ident = { 'I', 'D', 'S', 'P' },
         .version = ver,
@@ -136,14 +224,15 @@ struct Spr_Sprite *Spr_new(
         .syncType = syncType
     };
 
-    newColors = malloc(sizeof(*newColors) * palColorCt);
+    newColors = arenaAlloc(&arena, sizeof(*newColors) * palColorCt);
     memcpy(newColors, colors, sizeof(*colors) * palColorCt);
 
-    sprite = malloc(sizeof(*sprite));
     *sprite = (struct Spr_Sprite) {
+        arena,
         header,
         (struct Spr_palette) {palColorCt, newColors},
         NULL,
+        0,
         offsetX,
         offsetY
     };
@@ -151,72 +240,95 @@ struct Spr_Sprite *Spr_new(
     return sprite;
 }
 
-/* free frame's images, including raster */
-void freeFrame(union frame frame)
+void Spr_free(struct Spr_Sprite *sprite)
 {
-    if (frame.frameType == FRAME_SINGLE) {
-        free(frame.single.image.raster);
-    }
-    else {
-        for (int i = 0; i < frame.group.nImages; i++)
-            free(frame.group.images[i].raster);
-        free(frame.group.images);
-        free(frame.group.imgKeys);
-    }
+    /* copied out, since the sprite itself is in the arena */
+    struct arena arena = sprite->arena;
+    arenaFree(&arena);
 }
 
-void Spr_free(struct Spr_Sprite *sprite)
+void *Spr_alloc(struct Spr_Sprite *sprite, size_t size)
+{
+    return arenaAlloc(&sprite->arena, size);
+}
+
+static void reserveFrames(struct Spr_Sprite *sprite, int32_t frameCap)
 {
-    struct header *header = sprite->header;
-    for (int i = 0; i < header->nFrames; i++)
-        freeFrame(sprite->frames[i]);
-    free(sprite->frames);
-    free(sprite->palette.colors);
-    free(sprite->header);
-    free(sprite);
+    union frame *frames;
+    if (frameCap <= sprite->frameCap)
+        return;
+    frames = arenaAlloc(&sprite->arena, sizeof(*frames) * frameCap);
+    if (sprite->header->nFrames > 0)
+        memcpy(frames, sprite->frames,
+                sizeof(*frames) * sprite->header->nFrames);
+    sprite->frames = frames;
+    sprite->frameCap = frameCap;
+}
+
+void Spr_reserve(struct Spr_Sprite *sprite, int32_t frameCt, size_t byteCt)
+{
+    reserveFrames(sprite, frameCt);
+    arenaReserve(&sprite->arena, byteCt);
 }
 
 static void appendFrame(struct Spr_Sprite *sprite, union frame frame)
 {
     int32_t nFrames = sprite->header->nFrames;
-    sprite->frames = realloc(sprite->frames,
-            sizeof(*sprite->frames) * (nFrames + 1));
+    /* outgrown arrays stay in the arena, but doubling bounds the waste */
+    if (nFrames == sprite->frameCap)
+        reserveFrames(sprite, nFrames > 0 ? nFrames * 2 : 16);
     sprite->frames[nFrames] = frame;
     sprite->header->nFrames++;
 }
 
-void Spr_appendSingleFrame(struct Spr_Sprite *sprite,
+void Spr_takeSingleFrame(struct Spr_Sprite *sprite,
         struct Spr_image const *img)
 {
     union frame frame;
-    size_t rasterSz = img->width * img->height;
     frame.single = (struct singleFrame) { FRAME_SINGLE, *img };
-    frame.single.image.raster = malloc(rasterSz);
-    memcpy(frame.single.image.raster, img->raster, rasterSz);
     appendFrame(sprite, frame);
 }
 
-void Spr_appendGroupFrame(struct Spr_Sprite *sprite, float const *delays,
-        struct Spr_image const *imgs, size_t nImages)
+void Spr_appendSingleFrame(struct Spr_Sprite *sprite,
+        struct Spr_image const *img)
+{
+    struct Spr_image copy = *img;
+    size_t rasterSz = img->width * img->height;
+    copy.raster = Spr_alloc(sprite, rasterSz);
+    memcpy(copy.raster, img->raster, rasterSz);
+    Spr_takeSingleFrame(sprite, &copy);
+}
+
+void Spr_takeGroupFrame(struct Spr_Sprite *sprite, float *delays,
+        struct Spr_image *imgs, size_t nImages)
 {
     union frame frame;
-    size_t imagesSz = sizeof(struct Spr_image) * nImages;
-    float *imgKeys = malloc(sizeof(float) * nImages);
     float keyTime = 0;
-    frame.group = (struct groupFrame) { FRAME_GROUP, nImages, imgKeys, NULL };
-    frame.group.images =
-            (struct Spr_image *)malloc(imagesSz);
-    memcpy(frame.group.images, imgs, imagesSz);
+    /* key times replace the delays in place */
     for (int i = 0; i < nImages; i++) {
-        size_t rasterSz = imgs[i].width * imgs[i].height;
         keyTime+= delays[i] > 0 ? delays[i] : FLT_MIN;
-        imgKeys[i] = keyTime;
-        frame.group.images[i].raster = malloc(rasterSz);
-        memcpy(frame.group.images[i].raster, imgs[i].raster, rasterSz);
+        delays[i] = keyTime;
     }
+    frame.group = (struct groupFrame) { FRAME_GROUP, nImages, delays, imgs };
     appendFrame(sprite, frame);
 }
 
+void Spr_appendGroupFrame(struct Spr_Sprite *sprite, float const *delays,
+        struct Spr_image const *imgs, size_t nImages)
+{
+    size_t imagesSz = sizeof(struct Spr_image) * nImages;
+    float *delaysCopy = Spr_alloc(sprite, sizeof(float) * nImages);
+    struct Spr_image *imgsCopy = Spr_alloc(sprite, imagesSz);
+    memcpy(delaysCopy, delays, sizeof(float) * nImages);
+    memcpy(imgsCopy, imgs, imagesSz);
+    for (int i = 0; i < nImages; i++) {
+        size_t rasterSz = imgs[i].width * imgs[i].height;
+        imgsCopy[i].raster = Spr_alloc(sprite, rasterSz);
+        memcpy(imgsCopy[i].raster, imgs[i].raster, rasterSz);
+    }
+    Spr_takeGroupFrame(sprite, delaysCopy, imgsCopy, nImages);
+}
+
 static void errMsg(char const *filename, char const *message,
         Spr_onError_fp errCB)
 {
@@ -229,6 +341,7 @@ static void errMsg(char const *filename, char const *message,
     strcpy(fullMsg + fnLen, separator);
     strcpy(fullMsg + fnLen + sepLen, message);
     errCB(fullMsg);
+    free(fullMsg);
 }
 
 /* Helper macros for local I/O operations.  They are very situtional: they
@@ -250,156 +363,1601 @@ static void errMsg(char const *filename, char const *message,
     return 1;\
 }
 
-static int writeImage(struct Spr_Sprite const *sprite, struct Spr_image img,
-        FILE *file, char const *filename, Spr_onError_fp errCB)
+#define HEADER_SZ_QUAKE 36
+#define HEADER_SZ_HL    40
+#define IMAGE_HEADER_SZ 16
+/* nFrames is followed by beamLength and syncType to end the header */
+#define HEADER_TAIL_SZ  12
+
+/* Fields are encoded little-endian regardless of the host's byte order. */
+static uint8_t *putU16(uint8_t *dst, uint16_t value)
 {
-    size_t rasterSz = img.width * img.height;
-    int32_t totalOffsetX = img.offsetX + sprite->offsetX;
-    int32_t totalOffsetY = img.offsetY + sprite->offsetY;
+    dst[0] = (uint8_t)value;
+    dst[1] = (uint8_t)(value >> 8);
+    return dst + 2;
+}
 
-    if (fwrite((void *)&totalOffsetX, sizeof(totalOffsetX), 1, file) < 1)
-        MS_ERR_MSG_WRITE();
-    if (fwrite((void *)&totalOffsetY, sizeof(totalOffsetY), 1, file) < 1)
-        MS_ERR_MSG_WRITE();
-    if (fwrite((void *)&img.width, sizeof(img.width), 1, file) < 1) 
-        MS_ERR_MSG_WRITE();
-    if (fwrite((void *)&img.height, sizeof(img.height), 1, file) < 1)
-        MS_ERR_MSG_WRITE();
-    if (fwrite((void *)img.raster, 1, rasterSz, file) < rasterSz)
-        MS_ERR_MSG_WRITE();
-    return 0;
+static uint8_t *putU32(uint8_t *dst, uint32_t value)
+{
+    dst[0] = (uint8_t)value;
+    dst[1] = (uint8_t)(value >> 8);
+    dst[2] = (uint8_t)(value >> 16);
+    dst[3] = (uint8_t)(value >> 24);
+    return dst + 4;
 }
 
-static int writeHeader(struct header const *hdr, FILE *file,
-        char const *filename, Spr_onError_fp errCB)
+static uint8_t *putI32(uint8_t *dst, int32_t value)
 {
-    if (fwrite((void *)&hdr->ident, sizeof(hdr->ident), 1, file) < 1)
-        MS_ERR_MSG_WRITE();
-    if (fwrite((void *)&hdr->version, sizeof(hdr->version), 1, file) < 1)
-        MS_ERR_MSG_WRITE();
-    if (fwrite((void *)&hdr->alignment, sizeof(hdr->alignment), 1, file) < 1)
-        MS_ERR_MSG_WRITE();
+    return putU32(dst, (uint32_t)value);
+}
+
+static uint8_t *putF32(uint8_t *dst, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return putU32(dst, bits);
+}
+
+static uint8_t *encodeHeader(uint8_t *dst, struct header const *hdr)
+{
+    memcpy(dst, hdr->ident, sizeof(hdr->ident));
+    dst+= sizeof(hdr->ident);
+    dst = putI32(dst, hdr->version);
+    dst = putI32(dst, hdr->alignment);
+    if (hdr->version == SPR_VER_HL)
+        dst = putI32(dst, hdr->hlTexType);
+    dst = putF32(dst, hdr->radius);
+    dst = putI32(dst, hdr->maxWidth);
+    dst = putI32(dst, hdr->maxHeight);
+    dst = putI32(dst, hdr->nFrames);
+    dst = putF32(dst, hdr->beamLength);
+    dst = putI32(dst, hdr->syncType);
+    return dst;
+}
 
-    if (hdr->version == SPR_VER_HL) {
-        if (fwrite((void *)&hdr->hlTexType, sizeof(hdr->hlTexType), 1, file)<1)
-            MS_ERR_MSG_WRITE();
+static uint8_t *encodePalette(uint8_t *dst, struct Spr_palette const *pal)
+{
+    dst = putU16(dst, pal->colorCt);
+    for (int i = 0; i < pal->colorCt; i++) {
+        memcpy(dst, pal->colors[i].rgb, 3);
+        dst+= 3;
     }
+    return dst;
+}
 
-    if (fwrite((void *)&hdr->radius, sizeof(hdr->radius), 1, file) < 1)
-        MS_ERR_MSG_WRITE();
-    if (fwrite((void *)&hdr->maxWidth, sizeof(hdr->maxWidth), 1, file) < 1)
-        MS_ERR_MSG_WRITE();
-    if (fwrite((void *)&hdr->maxHeight, sizeof(hdr->maxHeight), 1, file) < 1)
-        MS_ERR_MSG_WRITE();
-    if (fwrite((void *)&hdr->nFrames, sizeof(hdr->nFrames), 1, file) < 1)
-        MS_ERR_MSG_WRITE();
-    if (fwrite((void *)&hdr->beamLength, sizeof(hdr->beamLength), 1, file) < 1)
-        MS_ERR_MSG_WRITE();
-    if (fwrite((void *)&hdr->syncType, sizeof(hdr->syncType), 1, file) < 1)
-        MS_ERR_MSG_WRITE();
-    return 0;
+static uint8_t *encodeImageHeader(uint8_t *dst,
+        struct Spr_Sprite const *sprite, struct Spr_image const *img)
+{
+    dst = putI32(dst, img->offsetX + sprite->offsetX);
+    dst = putI32(dst, img->offsetY + sprite->offsetY);
+    dst = putI32(dst, img->width);
+    dst = putI32(dst, img->height);
+    return dst;
 }
 
-int Spr_write(struct Spr_Sprite *sprite, char const *filename,
-        Spr_onError_fp errCB)
+/* Size of everything but the rasters, and the number of images. */
+static size_t metadataSize(struct Spr_Sprite const *sprite, size_t *imageCt)
 {
-    FILE *file = fopen(filename, "wb");
-    if (file == NULL)
-        MS_ERR_MSG_OPEN();
-//    if (fwrite((void *)sprite->header, sizeof(*sprite->header), 1, file) < 1)
-//        MS_ERR_MSG_WRITE();
-    if (writeHeader(sprite->header, file, filename, errCB))
-        return 1;
-    if (sprite->header->version == SPR_VER_HL) {
-        if (fwrite((void *)&sprite->palette.colorCt,
-                    sizeof(sprite->palette.colorCt), 1, file) < 1)
-            MS_ERR_MSG_WRITE();
-        if (fwrite((void *)sprite->palette.colors,
-                    sizeof(*sprite->palette.colors), sprite->palette.colorCt,
-                    file) < 1)
-            MS_ERR_MSG_WRITE();
-    }
-    for (size_t i = 0; i < sprite->header->nFrames; i++) {
-        union frame *frame = sprite->frames + i;
-        if (fwrite((void *)&frame->frameType,
-                sizeof(frame->frameType), 1, file) < 1) {
-            MS_ERR_MSG_WRITE();
+    struct header const *hdr = sprite->header;
+    size_t size;
+
+    *imageCt = 0;
+    if (hdr->version == SPR_VER_HL)
+        size = HEADER_SZ_HL + 2 + 3 * (size_t)sprite->palette.colorCt;
+    else
+        size = HEADER_SZ_QUAKE;
+
+    for (int32_t i = 0; i < hdr->nFrames; i++) {
+        union frame const *frame = sprite->frames + i;
+        size+= 4;
+        if (frame->frameType == FRAME_SINGLE) {
+            size+= IMAGE_HEADER_SZ;
+            (*imageCt)++;
         }
+        else {
+            size+= 4 + (4 + IMAGE_HEADER_SZ) * (size_t)frame->group.nImages;
+            *imageCt+= frame->group.nImages;
+        }
+    }
+    return size;
+}
+
+/* Start a raster span after closing the metadata span before it. */
+static struct Spr_span *pushRaster(struct Spr_span *spans, uint8_t const **metaStart,
+        uint8_t const *metaEnd, struct Spr_image const *img)
+{
+    *spans++ = (struct Spr_span) { *metaStart, metaEnd - *metaStart };
+    *spans++ = (struct Spr_span) { img->raster, (size_t)img->width * img->height };
+    *metaStart = metaEnd;
+    return spans;
+}
+
+/* Lay out the sprite file as alternating spans of encoded metadata, all in
+ * one buffer of the exact size, and rasters referenced where they are.
+ * Returns the number of spans.  The caller frees *metadata and *spans.
+ */
+static size_t serialize(struct Spr_Sprite const *sprite, uint8_t **metadata,
+        struct Spr_span **spans)
+{
+    struct header const *hdr = sprite->header;
+    size_t imageCt;
+    uint8_t *dst = malloc(metadataSize(sprite, &imageCt));
+    uint8_t const *metaStart = dst;
+    struct Spr_span *span = malloc(sizeof(*span) * (2 * imageCt + 1));
+
+    *metadata = dst;
+    *spans = span;
+
+    dst = encodeHeader(dst, hdr);
+    if (hdr->version == SPR_VER_HL)
+        dst = encodePalette(dst, &sprite->palette);
+
+    for (int32_t i = 0; i < hdr->nFrames; i++) {
+        union frame const *frame = sprite->frames + i;
+        dst = putI32(dst, frame->frameType);
         if (frame->frameType == FRAME_SINGLE) {
-            if (writeImage(sprite, frame->single.image,
-                    file, filename, errCB) != 0) {
-                return 1;
-            }
+            dst = encodeImageHeader(dst, sprite, &frame->single.image);
+            span = pushRaster(span, &metaStart, dst, &frame->single.image);
         }
         else {
             int32_t nImages = frame->group.nImages;
-            float *imgKeys = frame->group.imgKeys;
-            if (fwrite((void *)&nImages, sizeof(nImages), 1, file) < 1)
-                MS_ERR_MSG_WRITE();
-            if (fwrite(imgKeys, sizeof(*imgKeys), nImages, file) < nImages) {
-                MS_ERR_MSG_WRITE();
-            }
-            for (int j = 0; j < nImages; j++) {
-                if (writeImage(sprite, frame->group.images[j],
-                        file, filename, errCB) != 0) {
-                    return 1;
-                }
+            dst = putI32(dst, nImages);
+            for (int32_t j = 0; j < nImages; j++)
+                dst = putF32(dst, frame->group.imgKeys[j]);
+            for (int32_t j = 0; j < nImages; j++) {
+                dst = encodeImageHeader(dst, sprite, frame->group.images + j);
+                span = pushRaster(span, &metaStart, dst,
+                        frame->group.images + j);
             }
         }
     }
-    fclose(file);
+
+    *span++ = (struct Spr_span) { metaStart, dst - metaStart };
+    return span - *spans;
+}
+
+#ifndef _WIN32
+#define IOV_BATCH 1024
+
+/* Gather the spans straight to the file descriptor, in as few writev calls as
+ * the system's iovec limit and short writes allow.
+ */
+static int fdSinkWrite(void *userData, struct Spr_span const *spans,
+        size_t spanCt)
+{
+    int fd = (int)(intptr_t)userData;
+    long iovMax = sysconf(_SC_IOV_MAX);
+    struct iovec iov[IOV_BATCH];
+    size_t done = 0; /* bytes of spans[0] already written */
+
+    /* POSIX guarantees at least 16 */
+    if (iovMax < 16 || iovMax > IOV_BATCH)
+        iovMax = iovMax < 0 ? 16 : IOV_BATCH;
+
+    while (spanCt > 0) {
+        int iovCt = 0;
+        ssize_t written;
+
+        for (size_t i = 0; i < spanCt && iovCt < iovMax; i++) {
+            size_t skip = i == 0 ? done : 0;
+            iov[iovCt].iov_base = (uint8_t *)spans[i].data + skip;
+            iov[iovCt].iov_len = spans[i].size - skip;
+            iovCt++;
+        }
+
+        written = writev(fd, iov, iovCt);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+
+        done+= written;
+        while (spanCt > 0 && done >= spans->size) {
+            done-= spans->size;
+            spans++;
+            spanCt--;
+        }
+    }
     return 0;
 }
+#else
+/* Win32 has no writev, so write the spans one at a time. */
+static int fdSinkWrite(void *userData, struct Spr_span const *spans,
+        size_t spanCt)
+{
+    int fd = (int)(intptr_t)userData;
 
-int Spr_readPalette(char const *filename, struct Spr_color *colors,
+    for (size_t i = 0; i < spanCt; i++) {
+        uint8_t const *data = spans[i].data;
+        size_t left = spans[i].size;
+        while (left > 0) {
+            unsigned int chunk = left > INT_MAX ? INT_MAX : (unsigned int)left;
+            int written = _write(fd, data, chunk);
+            if (written < 0)
+                return 1;
+            data+= written;
+            left-= written;
+        }
+    }
+    return 0;
+}
+#endif
+
+struct Spr_sink Spr_fdSink(int fd)
+{
+    return (struct Spr_sink) { fdSinkWrite, (void *)(intptr_t)fd };
+}
+
+static int bufferSinkWrite(void *userData, struct Spr_span const *spans,
+        size_t spanCt)
+{
+    struct Spr_buffer *buffer = userData;
+    size_t total = 0;
+
+    for (size_t i = 0; i < spanCt; i++)
+        total+= spans[i].size;
+
+    if (total > buffer->capacity - buffer->size) {
+        size_t capacity = buffer->capacity * 2;
+        uint8_t *data;
+        if (capacity < buffer->size + total)
+            capacity = buffer->size + total;
+        data = realloc(buffer->data, capacity);
+        if (data == NULL)
+            return 1;
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+
+    for (size_t i = 0; i < spanCt; i++) {
+        if (spans[i].size > 0) {
+            memcpy(buffer->data + buffer->size, spans[i].data, spans[i].size);
+            buffer->size+= spans[i].size;
+        }
+    }
+    return 0;
+}
+
+struct Spr_sink Spr_bufferSink(struct Spr_buffer *buffer)
+{
+    return (struct Spr_sink) { bufferSinkWrite, buffer };
+}
+
+int Spr_writeSink(struct Spr_Sprite *sprite, struct Spr_sink sink,
+        char const *name, Spr_onError_fp errCB)
+{
+    uint8_t *metadata;
+    struct Spr_span *spans;
+    size_t spanCt = serialize(sprite, &metadata, &spans);
+    int writeErr = sink.write(sink.userData, spans, spanCt);
+
+    free(metadata);
+    free(spans);
+    if (writeErr) {
+        errMsg(name, "Write failure.", errCB);
+        return 1;
+    }
+    return 0;
+}
+
+int Spr_write(struct Spr_Sprite *sprite, char const *filename,
         Spr_onError_fp errCB)
 {
-    FILE *file = fopen(filename, "rb");
+    int writeErr;
+    FILE *file = fopen(filename, "wb");
+
     if (file == NULL)
         MS_ERR_MSG_OPEN();
-    if (fread(colors, sizeof(*colors), SPR_Q_PAL_SIZE, file) < SPR_Q_PAL_SIZE)
-        MS_ERR_MSG_READ();
-    fclose(file);
+
+#ifdef _WIN32
+    writeErr = Spr_writeSink(sprite, Spr_fdSink(_fileno(file)), filename,
+            errCB);
+#else
+    writeErr = Spr_writeSink(sprite, Spr_fdSink(fileno(file)), filename,
+            errCB);
+#endif
+
+    if (fclose(file) != 0 && !writeErr)
+        MS_ERR_MSG_WRITE();
+    return writeErr;
+}
+
+struct Spr_Writer
+{
+    struct Spr_Sprite const *sprite;
+    FILE *file;
+    char const *filename;
+    Spr_onError_fp errCB;
+    bool failed;      /* an error was already reported */
+    int32_t nFrames;
+    long nFramesPos;  /* file position of the header's frame count */
+    int32_t groupCt;  /* images declared for the open group frame, or 0 */
+    int32_t groupDone;
+    long keysPos;     /* file position of the group's key table */
+    float keyTime;
+    float *keys;
+};
+
+/* Report the first failure only; later calls just fail quietly. */
+static int writerFail(struct Spr_Writer *writer, char const *message)
+{
+    if (!writer->failed)
+        errMsg(writer->filename, message, writer->errCB);
+    writer->failed = true;
+    return 1;
+}
+
+static int writerPut(struct Spr_Writer *writer, void const *data, size_t size)
+{
+    if (writer->failed)
+        return 1;
+    if (size > 0 && fwrite(data, 1, size, writer->file) < size)
+        return writerFail(writer, "Write failure.");
     return 0;
 }
 
-void Spr_defaultQPalette(struct Spr_color *colors)
+/* Overwrite already written bytes at pos, then carry on at the end. */
+static int writerPatch(struct Spr_Writer *writer, long pos, void const *data,
+        size_t size)
 {
-    memcpy(colors, QUAKEPAL, sizeof(*colors) * SPR_Q_PAL_SIZE);
+    if (writer->failed)
+        return 1;
+    if (fseek(writer->file, pos, SEEK_SET) != 0 ||
+            fwrite(data, 1, size, writer->file) < size ||
+            fseek(writer->file, 0, SEEK_END) != 0) {
+        return writerFail(writer, "Write failure.");
+    }
+    return 0;
 }
 
-// R_WEIGHT**2 + G_WEIGHT**2 + B_WEIGHT**2 <= 2**31 / 255**2  
-#define R_WEIGHT 29
-#define G_WEIGHT 59
-#define B_WEIGHT 11
-double colorDistance(struct Spr_color color1, struct Spr_color color2)
+static int writerPutImage(struct Spr_Writer *writer,
+        struct Spr_image const *img)
 {
-    int deltas[3];
-    for (int i = 0; i < 3; i++) {
-        deltas[i] = (int)(color1.rgb[i]) - color2.rgb[i];
-        deltas[i]*= deltas[i];
+    uint8_t imgHeader[IMAGE_HEADER_SZ];
+    encodeImageHeader(imgHeader, writer->sprite, img);
+    if (writerPut(writer, imgHeader, sizeof(imgHeader)))
+        return 1;
+    return writerPut(writer, img->raster, (size_t)img->width * img->height);
+}
+
+struct Spr_Writer *Spr_newWriter(struct Spr_Sprite const *sprite,
+        char const *filename, Spr_onError_fp errCB)
+{
+    struct header hdr = *sprite->header;
+    size_t headerSz = hdr.version == SPR_VER_HL ?
+            HEADER_SZ_HL + 2 + 3 * (size_t)sprite->palette.colorCt :
+            HEADER_SZ_QUAKE;
+    uint8_t *encoded = malloc(headerSz);
+    uint8_t *dst;
+    struct Spr_Writer *writer;
+    FILE *file = fopen(filename, "wb");
+
+    if (file == NULL) {
+        free(encoded);
+        errMsg(filename, "Failed to open file.", errCB);
+        return NULL;
     }
-    return sqrt(
-            R_WEIGHT * R_WEIGHT * deltas[0] + 
-            G_WEIGHT * G_WEIGHT * deltas[1] + 
-            B_WEIGHT * B_WEIGHT * deltas[2]);
+
+    writer = malloc(sizeof(*writer));
+    *writer = (struct Spr_Writer) {
+        .sprite = sprite,
+        .file = file,
+        .filename = filename,
+        .errCB = errCB
+    };
+
+    /* frame count is patched in when the writer is closed */
+    hdr.nFrames = 0;
+    dst = encodeHeader(encoded, &hdr);
+    writer->nFramesPos = (long)(dst - encoded) - HEADER_TAIL_SZ;
+    if (hdr.version == SPR_VER_HL)
+        encodePalette(dst, &sprite->palette);
+
+    if (writerPut(writer, encoded, headerSz) ||
+            (ftell(file) < 0 && writerFail(writer, "File is not seekable."))) {
+        free(encoded);
+        fclose(file);
+        free(writer);
+        return NULL;
+    }
+    free(encoded);
+    return writer;
 }
 
-uint8_t Spr_nearestIndex(struct Spr_Sprite *sprite, struct Spr_color color)
+int Spr_writeSingleFrame(struct Spr_Writer *writer,
+        struct Spr_image const *img)
 {
-    struct Spr_palette pal = sprite->palette;
-    double minDist = INT_MAX;
-    char nearestIndex = 0;
-    for (int i = 0; i < pal.colorCt; i++) {
-        if (i != pal.colorCt - 1) {
-            double distance = colorDistance(pal.colors[i], color);
-            if (distance < minDist) {
-                minDist = distance;
-                nearestIndex = i;
-            }
-        }
+    uint8_t frameType[4];
+
+    if (writer->groupDone < writer->groupCt)
+        return writerFail(writer, "Group frame is missing images.");
+
+    putI32(frameType, FRAME_SINGLE);
+    if (writerPut(writer, frameType, sizeof(frameType)) ||
+            writerPutImage(writer, img)) {
+        return 1;
     }
-    return nearestIndex;
+    writer->nFrames++;
+    return 0;
+}
+
+int Spr_beginGroupFrame(struct Spr_Writer *writer, int32_t nImages)
+{
+    uint8_t groupHeader[8];
+    uint8_t *zeros;
+    int putErr;
+
+    if (writer->groupDone < writer->groupCt)
+        return writerFail(writer, "Group frame is missing images.");
+    if (nImages <= 0)
+        return writerFail(writer, "Group frame has no images.");
+
+    putI32(putI32(groupHeader, FRAME_GROUP), nImages);
+    if (writerPut(writer, groupHeader, sizeof(groupHeader)))
+        return 1;
+
+    /* keys are zeroed for now, and patched in once the group is complete */
+    free(writer->keys);
+    writer->keys = malloc(sizeof(*writer->keys) * nImages);
+    writer->keysPos = ftell(writer->file);
+    zeros = calloc(nImages, 4);
+    putErr = writerPut(writer, zeros, 4 * (size_t)nImages);
+    free(zeros);
+    if (putErr)
+        return 1;
+
+    writer->groupCt = nImages;
+    writer->groupDone = 0;
+    writer->keyTime = 0;
+    writer->nFrames++;
+    return 0;
+}
+
+int Spr_writeGroupImage(struct Spr_Writer *writer, float delay,
+        struct Spr_image const *img)
+{
+    if (writer->groupDone >= writer->groupCt)
+        return writerFail(writer, "Too many images for group frame.");
+
+    if (writerPutImage(writer, img))
+        return 1;
+
+    writer->keyTime+= delay > 0 ? delay : FLT_MIN;
+    writer->keys[writer->groupDone++] = writer->keyTime;
+
+    if (writer->groupDone == writer->groupCt) {
+        size_t keysSz = 4 * (size_t)writer->groupCt;
+        uint8_t *encoded = malloc(keysSz);
+        uint8_t *dst = encoded;
+        int patchErr;
+        for (int32_t i = 0; i < writer->groupCt; i++)
+            dst = putF32(dst, writer->keys[i]);
+        patchErr = writerPatch(writer, writer->keysPos, encoded, keysSz);
+        free(encoded);
+        return patchErr;
+    }
+    return 0;
+}
+
+int Spr_closeWriter(struct Spr_Writer *writer)
+{
+    uint8_t nFrames[4];
+    int closeErr;
+
+    if (writer->groupDone < writer->groupCt)
+        writerFail(writer, "Group frame is missing images.");
+
+    putI32(nFrames, writer->nFrames);
+    writerPatch(writer, writer->nFramesPos, nFrames, sizeof(nFrames));
+
+    if (fclose(writer->file) != 0)
+        writerFail(writer, "Write failure.");
+    closeErr = writer->failed;
+    free(writer->keys);
+    free(writer);
+    return closeErr;
+}
+
+/* Palettes are viewed in place, so colors must be packed RGB triplets. */
+_Static_assert(sizeof(struct Spr_color) == 3, "Spr_color must be 3 bytes");
+
+struct Spr_View
+{
+    struct Spr_info info;
+    struct Spr_frameView *frames;
+    struct Spr_image *images;
+    float *keys;
+    uint8_t const *data;
+    size_t size;
+    bool mapped;
+    void *handle; /* platform mapping handle, if any */
+};
+
+static uint32_t getU32(uint8_t const *src)
+{
+    return (uint32_t)src[0] | (uint32_t)src[1] << 8 |
+        (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+static int32_t getI32(uint8_t const *src)
+{
+    return (int32_t)getU32(src);
+}
+
+static float getF32(uint8_t const *src)
+{
+    uint32_t bits = getU32(src);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* Bounds-checked cursor over the file's bytes. */
+struct reader
+{
+    uint8_t const *pos;
+    size_t left;
+};
+
+static uint8_t const *take(struct reader *rd, size_t size)
+{
+    uint8_t const *pos = rd->pos;
+    if (size > rd->left)
+        return NULL;
+    rd->pos+= size;
+    rd->left-= size;
+    return pos;
+}
+
+static char const *parseImage(struct reader *rd, struct Spr_image *img)
+{
+    uint8_t const *field = take(rd, IMAGE_HEADER_SZ);
+    if (field == NULL)
+        return "Truncated image header.";
+    img->offsetX = getI32(field);
+    img->offsetY = getI32(field + 4);
+    img->width = getI32(field + 8);
+    img->height = getI32(field + 12);
+    if (img->width < 0 || img->height < 0)
+        return "Negative image size.";
+    if (img->width > 0 && (size_t)img->height > rd->left / img->width)
+        return "Truncated image.";
+    /* views never write through raster; Spr_translateView takes its own
+     * writable pointer to the data */
+    img->raster = (uint8_t *)take(rd, (size_t)img->width * img->height);
+    return NULL;
+}
+
+/* Index the frames of view->data.  Returns an error message, or NULL. */
+static char const *parseView(struct Spr_View *view)
+{
+    struct reader rd = { view->data, view->size };
+    struct Spr_info *info = &view->info;
+    uint8_t const *field;
+    size_t imageCap = 16;
+    size_t imageCt = 0;
+
+    field = take(&rd, 12);
+    if (field == NULL || memcmp(field, "IDSP", 4) != 0)
+        return "Not a sprite file.";
+    info->version = getI32(field + 4);
+    info->alignment = getI32(field + 8);
+    if (info->version != SPR_VER_QUAKE && info->version != SPR_VER_HL)
+        return "Unknown sprite version.";
+
+    field = take(&rd, (info->version == SPR_VER_HL ?
+            HEADER_SZ_HL : HEADER_SZ_QUAKE) - 12);
+    if (field == NULL)
+        return "Truncated header.";
+    if (info->version == SPR_VER_HL) {
+        info->texType = getI32(field);
+        field+= 4;
+    }
+    else {
+        info->texType = SPR_TEX_NORMAL;
+    }
+    info->radius = getF32(field);
+    info->maxWidth = getI32(field + 4);
+    info->maxHeight = getI32(field + 8);
+    info->nFrames = getI32(field + 12);
+    info->beamLength = getF32(field + 16);
+    info->syncType = getI32(field + 20);
+
+    if (info->version == SPR_VER_HL) {
+        field = take(&rd, 2);
+        if (field == NULL)
+            return "Truncated palette.";
+        info->palette.colorCt = (uint16_t)(field[0] | field[1] << 8);
+        if (info->palette.colorCt > SPR_MAX_PAL_SIZE)
+            return "Too many palette colors.";
+        info->palette.colors = (struct Spr_color *)
+                take(&rd, 3 * (size_t)info->palette.colorCt);
+        if (info->palette.colors == NULL)
+            return "Truncated palette.";
+    }
+    else {
+        info->palette = (struct Spr_palette) { 0, NULL };
+    }
+
+    /* every frame takes at least 20 bytes, which bounds a corrupt count */
+    if (info->nFrames < 0 || (size_t)info->nFrames > rd.left / 20)
+        return "Bad frame count.";
+
+    view->frames = malloc(sizeof(*view->frames) * (info->nFrames + 1));
+    view->images = malloc(sizeof(*view->images) * imageCap);
+    view->keys = malloc(sizeof(*view->keys) * imageCap);
+
+    for (int32_t i = 0; i < info->nFrames; i++) {
+        struct Spr_frameView *frame = view->frames + i;
+        int32_t frameType;
+        char const *imgErr;
+
+        field = take(&rd, 4);
+        if (field == NULL)
+            return "Truncated frame.";
+        frameType = getI32(field);
+
+        if (frameType == FRAME_SINGLE) {
+            frame->group = false;
+            frame->nImages = 1;
+        }
+        else if (frameType == FRAME_GROUP) {
+            frame->group = true;
+            field = take(&rd, 4);
+            if (field == NULL)
+                return "Truncated group frame.";
+            frame->nImages = getI32(field);
+            if (frame->nImages <= 0 ||
+                    (size_t)frame->nImages > rd.left / (4 + IMAGE_HEADER_SZ))
+                return "Bad group frame image count.";
+        }
+        else {
+            return "Unknown frame type.";
+        }
+
+        if (imageCt + frame->nImages > imageCap) {
+            while (imageCt + frame->nImages > imageCap)
+                imageCap*= 2;
+            view->images = realloc(view->images,
+                    sizeof(*view->images) * imageCap);
+            view->keys = realloc(view->keys, sizeof(*view->keys) * imageCap);
+        }
+
+        if (frame->group) {
+            field = take(&rd, 4 * (size_t)frame->nImages);
+            for (int32_t j = 0; j < frame->nImages; j++)
+                view->keys[imageCt + j] = getF32(field + 4 * j);
+        }
+
+        for (int32_t j = 0; j < frame->nImages; j++) {
+            imgErr = parseImage(&rd, view->images + imageCt + j);
+            if (imgErr != NULL)
+                return imgErr;
+        }
+        imageCt+= frame->nImages;
+    }
+
+    /* pointers are filled in once the arrays stop moving */
+    imageCt = 0;
+    for (int32_t i = 0; i < info->nFrames; i++) {
+        struct Spr_frameView *frame = view->frames + i;
+        frame->images = view->images + imageCt;
+        frame->imgKeys = frame->group ? view->keys + imageCt : NULL;
+        imageCt+= frame->nImages;
+    }
+    return NULL;
+}
+
+static void freeViewIndex(struct Spr_View *view)
+{
+    free(view->frames);
+    free(view->images);
+    free(view->keys);
+}
+
+struct Spr_View *Spr_read(void const *data, size_t size, char const *name,
+        Spr_onError_fp errCB)
+{
+    struct Spr_View *view = calloc(1, sizeof(*view));
+    char const *parseErr;
+
+    view->data = data;
+    view->size = size;
+    parseErr = parseView(view);
+    if (parseErr != NULL) {
+        errMsg(name, parseErr, errCB);
+        freeViewIndex(view);
+        free(view);
+        return NULL;
+    }
+    return view;
+}
+
+#ifdef _WIN32
+static int mapSprite(char const *filename, struct Spr_View *view)
+{
+    HANDLE file, mapping;
+    LARGE_INTEGER size;
+
+    file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return 1;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return 1;
+    }
+    view->size = (size_t)size.QuadPart;
+    if (view->size == 0) {
+        /* can't map empty files; parsing reports them */
+        CloseHandle(file);
+        return 0;
+    }
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL)
+        return 1;
+    view->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view->data == NULL) {
+        CloseHandle(mapping);
+        return 1;
+    }
+    view->handle = mapping;
+    return 0;
+}
+
+static void unmapSprite(struct Spr_View *view)
+{
+    if (view->data != NULL)
+        UnmapViewOfFile(view->data);
+    if (view->handle != NULL)
+        CloseHandle(view->handle);
+}
+#else
+static int mapSprite(char const *filename, struct Spr_View *view)
+{
+    struct stat st;
+    void *data;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd == -1)
+        return 1;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return 1;
+    }
+    view->size = (size_t)st.st_size;
+    if (view->size == 0) {
+        /* can't map empty files; parsing reports them */
+        close(fd);
+        return 0;
+    }
+    data = mmap(NULL, view->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return 1;
+    view->data = data;
+    return 0;
+}
+
+static void unmapSprite(struct Spr_View *view)
+{
+    if (view->data != NULL)
+        munmap((void *)view->data, view->size);
+}
+#endif
+
+struct Spr_View *Spr_map(char const *filename, Spr_onError_fp errCB)
+{
+    struct Spr_View *view = calloc(1, sizeof(*view));
+    char const *parseErr;
+
+    view->mapped = true;
+    if (mapSprite(filename, view) != 0) {
+        errMsg(filename, "Failed to open file.", errCB);
+        free(view);
+        return NULL;
+    }
+
+    parseErr = parseView(view);
+    if (parseErr != NULL) {
+        errMsg(filename, parseErr, errCB);
+        Spr_freeView(view);
+        return NULL;
+    }
+    return view;
+}
+
+void Spr_freeView(struct Spr_View *view)
+{
+    if (view->mapped)
+        unmapSprite(view);
+    freeViewIndex(view);
+    free(view);
+}
+
+struct Spr_info const *Spr_viewInfo(struct Spr_View const *view)
+{
+    return &view->info;
+}
+
+struct Spr_frameView const *Spr_viewFrame(struct Spr_View const *view,
+        int32_t frame)
+{
+    return view->frames + frame;
+}
+
+typedef void (*translateKernel_fp)(uint8_t *raster, size_t rasterSz,
+        uint8_t const *lookup);
+
+static void translateScalar(uint8_t *raster, size_t rasterSz,
+        uint8_t const *lookup)
+{
+    for (size_t k = 0; k < rasterSz; k++)
+        raster[k] = lookup[raster[k]];
+}
+
+#ifdef SPR_X86_SIMD
+/* Look up 32 bytes at a time as 16 shuffles of 16-entry rows of the table,
+ * indexed by the low nibble and kept where the high nibble picks the row.
+ */
+__attribute__((target("avx2")))
+static void translateAVX2(uint8_t *raster, size_t rasterSz,
+        uint8_t const *lookup)
+{
+    __m256i const nibble = _mm256_set1_epi8(0x0f);
+    __m256i rows[16];
+    size_t k = 0;
+
+    for (int row = 0; row < 16; row++) {
+        rows[row] = _mm256_broadcastsi128_si256(
+                _mm_loadu_si128((__m128i const *)(lookup + 16 * row)));
+    }
+    for (; k + 32 <= rasterSz; k+= 32) {
+        __m256i in = _mm256_loadu_si256((__m256i const *)(raster + k));
+        __m256i lo = _mm256_and_si256(in, nibble);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble);
+        __m256i out = _mm256_setzero_si256();
+        for (int row = 0; row < 16; row++) {
+            __m256i inRow = _mm256_cmpeq_epi8(hi, _mm256_set1_epi8(row));
+            out = _mm256_or_si256(out, _mm256_and_si256(inRow,
+                    _mm256_shuffle_epi8(rows[row], lo)));
+        }
+        _mm256_storeu_si256((__m256i *)(raster + k), out);
+    }
+    translateScalar(raster + k, rasterSz - k, lookup);
+}
+#endif
+
+static translateKernel_fp selectTranslateKernel(void)
+{
+#ifdef SPR_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return translateAVX2;
+#endif
+    return translateScalar;
+}
+
+int Spr_translateView(struct Spr_View const *view, uint8_t *data,
+        uint8_t const *lookup, Spr_onError_fp errCB)
+{
+    translateKernel_fp kernel = selectTranslateKernel();
+
+    if (view->mapped || data != view->data) {
+        errCB("Only sprites read from writable memory can be translated.");
+        return 1;
+    }
+    for (int32_t i = 0; i < view->info.nFrames; i++) {
+        struct Spr_frameView const *frame = view->frames + i;
+        for (int32_t j = 0; j < frame->nImages; j++) {
+            struct Spr_image const *img = frame->images + j;
+            /* write through data rather than the view's read-only rasters */
+            kernel(data + (img->raster - view->data),
+                    (size_t)img->width * img->height, lookup);
+        }
+    }
+    return 0;
+}
+
+struct Spr_Sprite *Spr_transcode(struct Spr_View const *view,
+        enum Spr_hlTextureType texType, uint16_t palColorCt,
+        struct Spr_color const *colors, float frameDelay)
+{
+    struct Spr_info const *info = &view->info;
+    enum Spr_version ver = info->version == SPR_VER_QUAKE ?
+            SPR_VER_HL : SPR_VER_QUAKE;
+    size_t imageCt = 0;
+    struct Spr_Sprite *sprite;
+
+    if (info->version == SPR_VER_HL && info->texType == SPR_TEX_INDEX_ALPHA)
+        return NULL;
+    for (int32_t i = 0; i < info->nFrames; i++)
+        imageCt+= view->frames[i].nImages;
+
+    /* stored image offsets already include the sprite's offsets */
+    sprite = Spr_new(ver, info->alignment, texType, info->maxWidth,
+            info->maxHeight, info->syncType, palColorCt, colors, 0, 0);
+    sprite->header->radius = info->radius;
+    sprite->header->beamLength = info->beamLength;
+
+    if (ver == SPR_VER_HL) {
+        /* same indices under the embedded palette, so rasters are borrowed */
+        reserveFrames(sprite, imageCt);
+        for (int32_t i = 0; i < info->nFrames; i++) {
+            struct Spr_frameView const *frame = view->frames + i;
+            for (int32_t j = 0; j < frame->nImages; j++)
+                Spr_takeSingleFrame(sprite, frame->images + j);
+        }
+    }
+    else if (imageCt > 0) {
+        uint8_t lookup[SPR_MAX_PAL_SIZE];
+        float *delays = Spr_alloc(sprite, sizeof(*delays) * imageCt);
+        struct Spr_image *imgs = Spr_alloc(sprite, sizeof(*imgs) * imageCt);
+        size_t k = 0;
+
+        /* only alpha-test leaves index 255 out; otherwise it's a color */
+        Spr_paletteTranslation(info->palette.colorCt, info->palette.colors,
+                palColorCt, colors, info->texType == SPR_TEX_ALPHA_TEST,
+                lookup);
+        for (int32_t i = 0; i < info->nFrames; i++) {
+            struct Spr_frameView const *frame = view->frames + i;
+            for (int32_t j = 0; j < frame->nImages; j++, k++) {
+                struct Spr_image const *img = frame->images + j;
+                size_t rasterSz = (size_t)img->width * img->height;
+                imgs[k] = *img;
+                imgs[k].raster = Spr_alloc(sprite, rasterSz);
+                for (size_t p = 0; p < rasterSz; p++)
+                    imgs[k].raster[p] = lookup[img->raster[p]];
+                /* group frames keep their own timing, from key deltas */
+                if (frame->group)
+                    delays[k] = frame->imgKeys[j] -
+                            (j > 0 ? frame->imgKeys[j - 1] : 0);
+                else
+                    delays[k] = frameDelay;
+            }
+        }
+        Spr_takeGroupFrame(sprite, delays, imgs, imageCt);
+    }
+    return sprite;
+}
+
+int Spr_readPalette(char const *filename, struct Spr_color *colors,
+        Spr_onError_fp errCB)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+        MS_ERR_MSG_OPEN();
+    if (fread(colors, sizeof(*colors), SPR_Q_PAL_SIZE, file) < SPR_Q_PAL_SIZE) {
+        fclose(file);
+        MS_ERR_MSG_READ();
+    }
+    fclose(file);
+    return 0;
+}
+
+void Spr_defaultQPalette(struct Spr_color *colors)
+{
+    memcpy(colors, QUAKEPAL, sizeof(*colors) * SPR_Q_PAL_SIZE);
+}
+
+// R_WEIGHT**2 + G_WEIGHT**2 + B_WEIGHT**2 <= 2**31 / 255**2  
+#define R_WEIGHT 29
+#define G_WEIGHT 59
+#define B_WEIGHT 11
+double colorDistance(struct Spr_color color1, struct Spr_color color2)
+{
+    int deltas[3];
+    for (int i = 0; i < 3; i++) {
+        deltas[i] = (int)(color1.rgb[i]) - color2.rgb[i];
+        deltas[i]*= deltas[i];
+    }
+    return sqrt(
+            R_WEIGHT * R_WEIGHT * deltas[0] + 
+            G_WEIGHT * G_WEIGHT * deltas[1] + 
+            B_WEIGHT * B_WEIGHT * deltas[2]);
+}
+
+uint8_t Spr_nearestIndex(struct Spr_Sprite *sprite, struct Spr_color color)
+{
+    struct Spr_palette pal = sprite->palette;
+    double minDist = INT_MAX;
+    char nearestIndex = 0;
+    for (int i = 0; i < pal.colorCt; i++) {
+        if (i != pal.colorCt - 1) {
+            double distance = colorDistance(pal.colors[i], color);
+            if (distance < minDist) {
+                minDist = distance;
+                nearestIndex = i;
+            }
+        }
+    }
+    return nearestIndex;
+}
+
+/* Squared form of colorDistance.  Orders colors the same way, without the
+ * square root.
+ */
+static uint32_t colorDistanceSq(struct Spr_color color1,
+        struct Spr_color color2)
+{
+    int deltas[3];
+    for (int i = 0; i < 3; i++) {
+        deltas[i] = (int)(color1.rgb[i]) - color2.rgb[i];
+        deltas[i]*= deltas[i];
+    }
+    return R_WEIGHT * R_WEIGHT * deltas[0] +
+           G_WEIGHT * G_WEIGHT * deltas[1] +
+           B_WEIGHT * B_WEIGHT * deltas[2];
+}
+
+/* Palette cache is a grid of cells, each covering CELL_SIZE**3 colors.  A cell
+ * holds either the one palette index nearest to all of its colors, or a list of
+ * candidate indices which must be searched exactly.
+ */
+#define CELL_BITS 5
+#define CELL_SHIFT (8 - CELL_BITS)
+#define CELL_SIZE (1 << CELL_SHIFT)
+#define CELL_CT (1 << (3 * CELL_BITS))
+#define CELL_EMPTY 0
+#define CELL_SINGLE 0x80000000u
+
+/* Palette cache also holds an open addressing hash table of exact palette
+ * colors.  Each slot packs a 24-bit color above the 8-bit index it maps to;
+ * index 255 is never stored, so no slot can equal EXACT_HT_EMPTY.
+ */
+#define EXACT_HT_BITS 9
+#define EXACT_HT_SIZE (1 << EXACT_HT_BITS)
+#define EXACT_HT_MASK (EXACT_HT_SIZE - 1)
+#define EXACT_HT_EMPTY 0xFFFFFFFFu
+#define EXACT_HT_GET_KEY(l) ((l) >> 8)
+#define EXACT_HT_GET_INDEX(l) ((l) & 0xFF)
+#define EXACT_HT_PUT(key, index) ((key) << 8 | (index))
+
+struct Spr_PalCache
+{
+    uint16_t colorCt;
+    struct Spr_color colors[SPR_MAX_PAL_SIZE];
+    uint32_t exact[EXACT_HT_SIZE];
+    uint32_t cells[CELL_CT]; /* CELL_EMPTY, CELL_SINGLE | index, or
+                                offset + 1 of candidate list in pool */
+    uint8_t *pool;           /* candidate lists: count, then indices */
+    size_t poolLen;
+    size_t poolCap;
+};
+
+static uint32_t colorKey(struct Spr_color color)
+{
+    return (uint32_t)color.rgb[0] << 16 | (uint32_t)color.rgb[1] << 8 |
+        color.rgb[2];
+}
+
+/* multiplicative hash, taking the top EXACT_HT_BITS bits */
+static uint32_t exactSlot(uint32_t key)
+{
+    return (key * 2654435761u) >> (32 - EXACT_HT_BITS);
+}
+
+struct Spr_PalCache *Spr_newPalCache(uint16_t palColorCt,
+        struct Spr_color const *colors)
+{
+    struct Spr_PalCache *cache = malloc(sizeof(*cache));
+    if (palColorCt > SPR_MAX_PAL_SIZE)
+        palColorCt = SPR_MAX_PAL_SIZE;
+    cache->colorCt = palColorCt;
+    memcpy(cache->colors, colors, sizeof(*colors) * palColorCt);
+    memset(cache->cells, CELL_EMPTY, sizeof(cache->cells));
+    cache->pool = NULL;
+    cache->poolLen = 0;
+    cache->poolCap = 0;
+
+    /* the last index is never selected, and duplicates keep the lowest index,
+     * as in nearestIndex
+     */
+    memset(cache->exact, 0xFF, sizeof(cache->exact));
+    for (int i = 0; i < palColorCt - 1; i++) {
+        uint32_t key = colorKey(colors[i]);
+        uint32_t slot = exactSlot(key);
+        while (cache->exact[slot] != EXACT_HT_EMPTY &&
+                EXACT_HT_GET_KEY(cache->exact[slot]) != key) {
+            slot = (slot + 1) & EXACT_HT_MASK;
+        }
+        if (cache->exact[slot] == EXACT_HT_EMPTY)
+            cache->exact[slot] = EXACT_HT_PUT(key, (uint32_t)i);
+    }
+    return cache;
+}
+
+void Spr_freePalCache(struct Spr_PalCache *cache)
+{
+    free(cache->pool);
+    free(cache);
+}
+
+/* weighted squared distance from channel value to span [lo, hi] */
+static uint32_t spanDistanceSq(int value, int lo, int hi, int weight)
+{
+    int delta = value < lo ? lo - value : (value > hi ? value - hi : 0);
+    return weight * weight * delta * delta;
+}
+
+/* weighted squared distance from channel value to furthest end of span */
+static uint32_t spanFarDistanceSq(int value, int lo, int hi, int weight)
+{
+    int delta = value - lo > hi - value ? value - lo : hi - value;
+    return weight * weight * delta * delta;
+}
+
+/* Find every palette index which may be nearest to some color in the cell, and
+ * store them in the cell.  Any index further from the whole cell than some
+ * other index is from the furthest corner of the cell can be discarded.
+ */
+static uint32_t fillCell(struct Spr_PalCache *cache, uint32_t cellIdx,
+        struct Spr_color color)
+{
+    int const weights[3] = { R_WEIGHT, G_WEIGHT, B_WEIGHT };
+    uint32_t nearDists[SPR_MAX_PAL_SIZE];
+    uint32_t minFarDist = UINT32_MAX;
+    uint8_t candidates[SPR_MAX_PAL_SIZE];
+    int candidateCt = 0;
+    int searchCt = cache->colorCt - 1; /* last index is never selected */
+
+    for (int i = 0; i < searchCt; i++) {
+        uint32_t nearDist = 0, farDist = 0;
+        for (int c = 0; c < 3; c++) {
+            int lo = color.rgb[c] & ~(CELL_SIZE - 1);
+            int hi = lo + CELL_SIZE - 1;
+            int value = cache->colors[i].rgb[c];
+            nearDist+= spanDistanceSq(value, lo, hi, weights[c]);
+            farDist+= spanFarDistanceSq(value, lo, hi, weights[c]);
+        }
+        nearDists[i] = nearDist;
+        if (farDist < minFarDist)
+            minFarDist = farDist;
+    }
+
+    for (int i = 0; i < searchCt; i++) {
+        if (nearDists[i] <= minFarDist)
+            candidates[candidateCt++] = i;
+    }
+
+    if (candidateCt <= 1) {
+        cache->cells[cellIdx] = CELL_SINGLE | (candidateCt ? candidates[0] : 0);
+    }
+    else {
+        if (cache->poolLen + candidateCt + 1 > cache->poolCap) {
+            cache->poolCap = 2 * cache->poolCap + candidateCt + 1;
+            cache->pool = realloc(cache->pool, cache->poolCap);
+        }
+        cache->cells[cellIdx] = cache->poolLen + 1;
+        cache->pool[cache->poolLen++] = candidateCt;
+        memcpy(cache->pool + cache->poolLen, candidates, candidateCt);
+        cache->poolLen+= candidateCt;
+    }
+    return cache->cells[cellIdx];
+}
+
+uint8_t Spr_palCacheNearest(struct Spr_PalCache *cache,
+        struct Spr_color color)
+{
+    uint32_t cellIdx =
+        (uint32_t)(color.rgb[0] >> CELL_SHIFT) << (2 * CELL_BITS) |
+        (uint32_t)(color.rgb[1] >> CELL_SHIFT) << CELL_BITS |
+        (uint32_t)(color.rgb[2] >> CELL_SHIFT);
+    uint32_t cell = cache->cells[cellIdx];
+    uint32_t key = colorKey(color);
+    uint32_t slot = exactSlot(key);
+    uint8_t const *candidates;
+    uint32_t minDist = UINT32_MAX;
+    uint8_t nearestIndex = 0;
+
+    while (cache->exact[slot] != EXACT_HT_EMPTY) {
+        if (EXACT_HT_GET_KEY(cache->exact[slot]) == key)
+            return (uint8_t)EXACT_HT_GET_INDEX(cache->exact[slot]);
+        slot = (slot + 1) & EXACT_HT_MASK;
+    }
+
+    if (cell == CELL_EMPTY)
+        cell = fillCell(cache, cellIdx, color);
+    if (cell & CELL_SINGLE)
+        return (uint8_t)(cell & 0xff);
+
+    /* candidates are in ascending order, so ties resolve as in nearestIndex */
+    candidates = cache->pool + cell;
+    for (int i = 0; i < cache->pool[cell - 1]; i++) {
+        uint32_t distance =
+            colorDistanceSq(cache->colors[candidates[i]], color);
+        if (distance < minDist) {
+            minDist = distance;
+            nearestIndex = candidates[i];
+        }
+    }
+    return nearestIndex;
+}
+
+/* Palette tree nodes are stored implicitly: the node for index range [lo, hi)
+ * sits at the range's midpoint, splitting on dims[mid], with the left subtree
+ * in [lo, mid) and the right in (mid, hi).  Coordinates are scaled by channel
+ * weights so plain Euclidean distance matches colorDistance.
+ */
+struct Spr_PalTree
+{
+    int nodeCt;
+    uint8_t indices[SPR_MAX_PAL_SIZE];      /* palette index of each node */
+    int32_t coords[SPR_MAX_PAL_SIZE][3];    /* weighted color of each node */
+    uint8_t dims[SPR_MAX_PAL_SIZE];         /* split dimension of each node */
+};
+
+static void swapNodes(struct Spr_PalTree *tree, int a, int b)
+{
+    uint8_t index = tree->indices[a];
+    int32_t coord[3];
+    memcpy(coord, tree->coords[a], sizeof(coord));
+    tree->indices[a] = tree->indices[b];
+    memcpy(tree->coords[a], tree->coords[b], sizeof(coord));
+    tree->indices[b] = index;
+    memcpy(tree->coords[b], coord, sizeof(coord));
+}
+
+static void buildPalTree(struct Spr_PalTree *tree, int lo, int hi)
+{
+    int mid = (lo + hi) / 2;
+    int dim = 0;
+    int32_t maxSpread = -1;
+
+    if (hi - lo < 1)
+        return;
+
+    for (int d = 0; d < 3; d++) {
+        int32_t min = INT32_MAX, max = INT32_MIN;
+        for (int i = lo; i < hi; i++) {
+            if (tree->coords[i][d] < min)
+                min = tree->coords[i][d];
+            if (tree->coords[i][d] > max)
+                max = tree->coords[i][d];
+        }
+        if (max - min > maxSpread) {
+            maxSpread = max - min;
+            dim = d;
+        }
+    }
+
+    /* insertion sort along split dimension; ranges are at most 255 long */
+    for (int i = lo + 1; i < hi; i++) {
+        for (int j = i; j > lo &&
+                tree->coords[j - 1][dim] > tree->coords[j][dim]; j--) {
+            swapNodes(tree, j - 1, j);
+        }
+    }
+
+    tree->dims[mid] = dim;
+    buildPalTree(tree, lo, mid);
+    buildPalTree(tree, mid + 1, hi);
+}
+
+struct Spr_PalTree *Spr_newPalTree(uint16_t palColorCt,
+        struct Spr_color const *colors)
+{
+    int const weights[3] = { R_WEIGHT, G_WEIGHT, B_WEIGHT };
+    struct Spr_PalTree *tree = malloc(sizeof(*tree));
+    if (palColorCt > SPR_MAX_PAL_SIZE)
+        palColorCt = SPR_MAX_PAL_SIZE;
+    tree->nodeCt = palColorCt > 0 ? palColorCt - 1 : 0;
+    for (int i = 0; i < tree->nodeCt; i++) {
+        tree->indices[i] = i;
+        for (int d = 0; d < 3; d++)
+            tree->coords[i][d] = weights[d] * colors[i].rgb[d];
+    }
+    buildPalTree(tree, 0, tree->nodeCt);
+    return tree;
+}
+
+void Spr_freePalTree(struct Spr_PalTree *tree)
+{
+    free(tree);
+}
+
+struct treeSearch
+{
+    int32_t target[3];
+    uint32_t minDist;
+    int nearestIndex;
+};
+
+static void searchPalTree(struct Spr_PalTree const *tree,
+        struct treeSearch *search, int lo, int hi)
+{
+    int mid = (lo + hi) / 2;
+    int32_t const *coord;
+    int32_t planeDelta;
+    uint32_t distance = 0;
+
+    if (hi - lo < 1)
+        return;
+
+    coord = tree->coords[mid];
+    for (int d = 0; d < 3; d++) {
+        int32_t delta = coord[d] - search->target[d];
+        distance+= (uint32_t)(delta * delta);
+    }
+    /* lower index wins ties, as in nearestIndex */
+    if (distance < search->minDist || (distance == search->minDist &&
+            tree->indices[mid] < search->nearestIndex)) {
+        search->minDist = distance;
+        search->nearestIndex = tree->indices[mid];
+    }
+
+    planeDelta = search->target[tree->dims[mid]] - coord[tree->dims[mid]];
+    if (planeDelta < 0) {
+        searchPalTree(tree, search, lo, mid);
+        if ((uint32_t)(planeDelta * planeDelta) <= search->minDist)
+            searchPalTree(tree, search, mid + 1, hi);
+    }
+    else {
+        searchPalTree(tree, search, mid + 1, hi);
+        if ((uint32_t)(planeDelta * planeDelta) <= search->minDist)
+            searchPalTree(tree, search, lo, mid);
+    }
+}
+
+uint8_t Spr_palTreeNearest(struct Spr_PalTree const *tree,
+        struct Spr_color color)
+{
+    struct treeSearch search = {
+        { R_WEIGHT * color.rgb[0], G_WEIGHT * color.rgb[1],
+            B_WEIGHT * color.rgb[2] },
+        UINT32_MAX,
+        0
+    };
+    searchPalTree(tree, &search, 0, tree->nodeCt);
+    return (uint8_t)search.nearestIndex;
+}
+
+/* Vectorized palette is a structure of arrays of weighted color channels, so
+ * that (w*dR)**2 + (w*dG)**2 + (w*dB)**2 gives the squared colorDistance.  All
+ * weighted values fit in 16 bits.  Entries past entryCt are padded with a
+ * sentinel color further from any color than any real palette entry can be.
+ */
+#define PALVEC_SENTINEL INT16_MAX
+
+typedef uint8_t (*palVecKernel_fp)(struct Spr_PalVec const *vec,
+        int16_t const *target);
+
+struct Spr_PalVec
+{
+    int entryCt;
+    int16_t chans[3][SPR_MAX_PAL_SIZE];
+    palVecKernel_fp kernel;
+};
+
+static void weighColor(struct Spr_color color, int16_t *weighted)
+{
+    weighted[0] = R_WEIGHT * color.rgb[0];
+    weighted[1] = G_WEIGHT * color.rgb[1];
+    weighted[2] = B_WEIGHT * color.rgb[2];
+}
+
+static uint8_t palVecNearestScalar(struct Spr_PalVec const *vec,
+        int16_t const *target)
+{
+    uint32_t minDist = UINT32_MAX;
+    uint8_t nearestIndex = 0;
+    for (int i = 0; i < vec->entryCt; i++) {
+        uint32_t distance = 0;
+        for (int c = 0; c < 3; c++) {
+            int32_t delta = vec->chans[c][i] - target[c];
+            distance+= (uint32_t)(delta * delta);
+        }
+        if (distance < minDist) {
+            minDist = distance;
+            nearestIndex = i;
+        }
+    }
+    return nearestIndex;
+}
+
+#ifdef SPR_X86_SIMD
+/* Reduce per-lane minimum distances and their indices to the lowest index of
+ * the overall minimum.  Each lane already holds its own lowest such index.
+ */
+static uint8_t lanesArgmin(int32_t const *dists, int32_t const *indices,
+        int laneCt)
+{
+    int32_t minDist = INT32_MAX;
+    int32_t nearestIndex = 0;
+    for (int i = 0; i < laneCt; i++) {
+        if (dists[i] < minDist ||
+                (dists[i] == minDist && indices[i] < nearestIndex)) {
+            minDist = dists[i];
+            nearestIndex = indices[i];
+        }
+    }
+    return (uint8_t)nearestIndex;
+}
+
+__attribute__((target("sse2")))
+static uint8_t palVecNearestSSE2(struct Spr_PalVec const *vec,
+        int16_t const *target)
+{
+    __m128i const tR = _mm_set1_epi16(target[0]);
+    __m128i const tG = _mm_set1_epi16(target[1]);
+    __m128i const tB = _mm_set1_epi16(target[2]);
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const step = _mm_set1_epi32(8);
+    __m128i idxLo = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i idxHi = _mm_setr_epi32(4, 5, 6, 7);
+    __m128i minDist = _mm_set1_epi32(INT32_MAX);
+    __m128i minIdx = zero;
+    int32_t dists[4], indices[4];
+
+    for (int i = 0; i < vec->entryCt; i+= 8) {
+        __m128i dR = _mm_sub_epi16(
+                _mm_loadu_si128((__m128i const *)(vec->chans[0] + i)), tR);
+        __m128i dG = _mm_sub_epi16(
+                _mm_loadu_si128((__m128i const *)(vec->chans[1] + i)), tG);
+        __m128i dB = _mm_sub_epi16(
+                _mm_loadu_si128((__m128i const *)(vec->chans[2] + i)), tB);
+        __m128i rgLo = _mm_unpacklo_epi16(dR, dG);
+        __m128i rgHi = _mm_unpackhi_epi16(dR, dG);
+        __m128i bLo = _mm_unpacklo_epi16(dB, zero);
+        __m128i bHi = _mm_unpackhi_epi16(dB, zero);
+        __m128i distLo = _mm_add_epi32(_mm_madd_epi16(rgLo, rgLo),
+                _mm_madd_epi16(bLo, bLo));
+        __m128i distHi = _mm_add_epi32(_mm_madd_epi16(rgHi, rgHi),
+                _mm_madd_epi16(bHi, bHi));
+        __m128i lt;
+
+        lt = _mm_cmplt_epi32(distLo, minDist);
+        minDist = _mm_or_si128(_mm_and_si128(lt, distLo),
+                _mm_andnot_si128(lt, minDist));
+        minIdx = _mm_or_si128(_mm_and_si128(lt, idxLo),
+                _mm_andnot_si128(lt, minIdx));
+        lt = _mm_cmplt_epi32(distHi, minDist);
+        minDist = _mm_or_si128(_mm_and_si128(lt, distHi),
+                _mm_andnot_si128(lt, minDist));
+        minIdx = _mm_or_si128(_mm_and_si128(lt, idxHi),
+                _mm_andnot_si128(lt, minIdx));
+
+        idxLo = _mm_add_epi32(idxLo, step);
+        idxHi = _mm_add_epi32(idxHi, step);
+    }
+
+    _mm_storeu_si128((__m128i *)dists, minDist);
+    _mm_storeu_si128((__m128i *)indices, minIdx);
+    return lanesArgmin(dists, indices, 4);
+}
+
+__attribute__((target("avx2")))
+static uint8_t palVecNearestAVX2(struct Spr_PalVec const *vec,
+        int16_t const *target)
+{
+    __m256i const tR = _mm256_set1_epi16(target[0]);
+    __m256i const tG = _mm256_set1_epi16(target[1]);
+    __m256i const tB = _mm256_set1_epi16(target[2]);
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i const step = _mm256_set1_epi32(16);
+    /* unpacking works within 128-bit lanes, so indices interleave likewise */
+    __m256i idxLo = _mm256_setr_epi32(0, 1, 2, 3, 8, 9, 10, 11);
+    __m256i idxHi = _mm256_setr_epi32(4, 5, 6, 7, 12, 13, 14, 15);
+    __m256i minDist = _mm256_set1_epi32(INT32_MAX);
+    __m256i minIdx = zero;
+    int32_t dists[8], indices[8];
+
+    for (int i = 0; i < vec->entryCt; i+= 16) {
+        __m256i dR = _mm256_sub_epi16(
+                _mm256_loadu_si256((__m256i const *)(vec->chans[0] + i)), tR);
+        __m256i dG = _mm256_sub_epi16(
+                _mm256_loadu_si256((__m256i const *)(vec->chans[1] + i)), tG);
+        __m256i dB = _mm256_sub_epi16(
+                _mm256_loadu_si256((__m256i const *)(vec->chans[2] + i)), tB);
+        __m256i rgLo = _mm256_unpacklo_epi16(dR, dG);
+        __m256i rgHi = _mm256_unpackhi_epi16(dR, dG);
+        __m256i bLo = _mm256_unpacklo_epi16(dB, zero);
+        __m256i bHi = _mm256_unpackhi_epi16(dB, zero);
+        __m256i distLo = _mm256_add_epi32(_mm256_madd_epi16(rgLo, rgLo),
+                _mm256_madd_epi16(bLo, bLo));
+        __m256i distHi = _mm256_add_epi32(_mm256_madd_epi16(rgHi, rgHi),
+                _mm256_madd_epi16(bHi, bHi));
+        __m256i lt;
+
+        lt = _mm256_cmpgt_epi32(minDist, distLo);
+        minDist = _mm256_blendv_epi8(minDist, distLo, lt);
+        minIdx = _mm256_blendv_epi8(minIdx, idxLo, lt);
+        lt = _mm256_cmpgt_epi32(minDist, distHi);
+        minDist = _mm256_blendv_epi8(minDist, distHi, lt);
+        minIdx = _mm256_blendv_epi8(minIdx, idxHi, lt);
+
+        idxLo = _mm256_add_epi32(idxLo, step);
+        idxHi = _mm256_add_epi32(idxHi, step);
+    }
+
+    _mm256_storeu_si256((__m256i *)dists, minDist);
+    _mm256_storeu_si256((__m256i *)indices, minIdx);
+    return lanesArgmin(dists, indices, 8);
+}
+#endif
+
+static palVecKernel_fp selectPalVecKernel(void)
+{
+#ifdef SPR_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return palVecNearestAVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return palVecNearestSSE2;
+#endif
+    return palVecNearestScalar;
+}
+
+struct Spr_PalVec *Spr_newPalVec(uint16_t palColorCt,
+        struct Spr_color const *colors)
+{
+    struct Spr_PalVec *vec = malloc(sizeof(*vec));
+    if (palColorCt > SPR_MAX_PAL_SIZE)
+        palColorCt = SPR_MAX_PAL_SIZE;
+    vec->entryCt = palColorCt > 0 ? palColorCt - 1 : 0;
+    for (int i = 0; i < SPR_MAX_PAL_SIZE; i++) {
+        if (i < vec->entryCt) {
+            int16_t weighted[3];
+            weighColor(colors[i], weighted);
+            for (int c = 0; c < 3; c++)
+                vec->chans[c][i] = weighted[c];
+        }
+        else {
+            /* only one channel, so sentinel distances can't overflow */
+            vec->chans[0][i] = PALVEC_SENTINEL;
+            vec->chans[1][i] = 0;
+            vec->chans[2][i] = 0;
+        }
+    }
+    vec->kernel = selectPalVecKernel();
+    return vec;
+}
+
+void Spr_freePalVec(struct Spr_PalVec *vec)
+{
+    free(vec);
+}
+
+uint8_t Spr_palVecNearest(struct Spr_PalVec const *vec,
+        struct Spr_color color)
+{
+    int16_t target[3];
+    if (vec->entryCt == 0)
+        return 0;
+    weighColor(color, target);
+    return vec->kernel(vec, target);
+}
+
+void Spr_palVecNearestBatch(struct Spr_PalVec const *vec,
+        struct Spr_color const *colors, size_t colorCt, uint8_t *indices)
+{
+    if (vec->entryCt == 0) {
+        memset(indices, 0, colorCt);
+        return;
+    }
+    for (size_t i = 0; i < colorCt; i++) {
+        int16_t target[3];
+        weighColor(colors[i], target);
+        indices[i] = vec->kernel(vec, target);
+    }
+}
+
+void Spr_paletteTranslation(uint16_t fromColorCt,
+        struct Spr_color const *from, uint16_t toColorCt,
+        struct Spr_color const *to, bool keepTransIdx, uint8_t *lookup)
+{
+    struct Spr_PalVec *vec = Spr_newPalVec(toColorCt, to);
+
+    if (fromColorCt > SPR_MAX_PAL_SIZE)
+        fromColorCt = SPR_MAX_PAL_SIZE;
+    for (int i = fromColorCt; i < SPR_MAX_PAL_SIZE; i++)
+        lookup[i] = (uint8_t)i;
+    Spr_palVecNearestBatch(vec, from, fromColorCt, lookup);
+    if (keepTransIdx)
+        lookup[SPR_TRANS_IDX] = SPR_TRANS_IDX;
+    Spr_freePalVec(vec);
 }
 
 uint8_t Spr_brightness(struct Spr_color color) 
@@ -32,6 +32,7 @@
 #ifndef SPRITE_H_
 #define SPRITE_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -78,10 +79,34 @@ enum Spr_syncType
  */
 typedef void (*Spr_onError_fp)(char const *errString);
 
+struct Spr_span;
+
+/* Output sink callback.  Writes spanCt spans, in order, after anything written
+ * by earlier calls for the same sprite.  May be called more than once per
+ * sprite.  Returns 0 on success, nonzero on failure.
+ */
+typedef int (*Spr_write_fp)(void *userData, struct Spr_span const *spans,
+        size_t spanCt);
+
 /* Structs */
 
 struct Spr_Sprite;
 
+/* Incremental writer, putting frames in a file as they're produced. */
+struct Spr_Writer;
+
+/* Sprite file parsed in place, from a mapping or a caller's buffer. */
+struct Spr_View;
+
+/* Lookup cache accelerating nearest color searches against one palette. */
+struct Spr_PalCache;
+
+/* k-d tree over palette colors for nearest color searches. */
+struct Spr_PalTree;
+
+/* Palette laid out for vectorized nearest color searches. */
+struct Spr_PalVec;
+
 struct Spr_color
 {
     uint8_t rgb[3];
@@ -93,6 +118,30 @@ struct Spr_palette
     struct Spr_color *colors;
 };
 
+/* A run of bytes to write out. */
+struct Spr_span
+{
+    void const *data;
+    size_t size;
+};
+
+/* Where a sprite is written: write is called with userData. */
+struct Spr_sink
+{
+    Spr_write_fp write;
+    void *userData;
+};
+
+/* Growable in-memory output.  Start from all zeros; written bytes are appended
+ * after size.  data is from malloc, for the caller to free.
+ */
+struct Spr_buffer
+{
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+};
+
 struct Spr_image
 {
     int32_t offsetX; /* image's local offsets, added to sprite's offsets */
@@ -102,6 +151,33 @@ struct Spr_image
     uint8_t *raster; /* list of palette indices */
 };
 
+/* Header of a sprite file read by Spr_map or Spr_read. */
+struct Spr_info
+{
+    enum Spr_version version;
+    enum Spr_alignment alignment;
+    enum Spr_hlTextureType texType; /* SPR_TEX_NORMAL for Quake */
+    float radius;
+    int32_t maxWidth;
+    int32_t maxHeight;
+    int32_t nFrames;
+    float beamLength;
+    enum Spr_syncType syncType;
+    struct Spr_palette palette; /* HL only, colorCt is 0 for Quake */
+};
+
+/* A frame of a sprite file.  Image offsets are as stored, with the sprite's
+ * offsets already added in.  Rasters and palette colors point into the file's
+ * bytes and must not be written.
+ */
+struct Spr_frameView
+{
+    bool group;
+    int32_t nImages;       /* 1 for single frames */
+    float const *imgKeys;  /* each image's end time in seconds, NULL if single */
+    struct Spr_image const *images;
+};
+
 /* Functions */
 
 /* Allocate memory for and create a new sprite.
@@ -124,11 +200,22 @@ struct Spr_Sprite *Spr_new(
         int32_t offsetX,
         int32_t offsetY);
 
-/* Deallocate memory used by the sprite, and all members recursively, except for
- * palette.
+/* Deallocate memory used by the sprite, including everything from Spr_alloc.
+ * The palette passed to Spr_new, and rasters borrowed by Spr_take*, are the
+ * caller's.
  */
 void Spr_free(struct Spr_Sprite *sprite);
 
+/* Allocate size bytes owned by the sprite, freed along with it.  Memory is
+ * never released before then.  Not thread safe per sprite.
+ */
+void *Spr_alloc(struct Spr_Sprite *sprite, size_t size);
+
+/* Make room for frameCt frames in all, and byteCt bytes of Spr_alloc calls, so
+ * storage need not grow while they're added.
+ */
+void Spr_reserve(struct Spr_Sprite *sprite, int32_t frameCt, size_t byteCt);
+
 /* Append a new frame to the sprite, copying image data provided. */
 void Spr_appendSingleFrame(struct Spr_Sprite *sprite,
     struct Spr_image const *img);
@@ -139,6 +226,21 @@ void Spr_appendSingleFrame(struct Spr_Sprite *sprite,
 void Spr_appendGroupFrame(struct Spr_Sprite *sprite, float const *delays,
         struct Spr_image const *imgs, size_t nImages);
 
+/* Append a new frame to the sprite, using img's raster in place rather than
+ * copying it.  A raster from Spr_alloc on this sprite is freed along with it;
+ * any other raster is borrowed, never freed, and must outlive the sprite.
+ */
+void Spr_takeSingleFrame(struct Spr_Sprite *sprite,
+    struct Spr_image const *img);
+
+/* Append a group of nImages frames, using delays, imgs and each image's raster
+ * in place rather than copying them.  delays and imgs must come from Spr_alloc
+ * on this sprite; rasters are owned or borrowed as per Spr_takeSingleFrame.
+ * delays is overwritten.
+ */
+void Spr_takeGroupFrame(struct Spr_Sprite *sprite, float *delays,
+        struct Spr_image *imgs, size_t nImages);
+
 /* Write a sprite out to file.
  * errCB - Callback called on error.
  * errStream - Stream to print error messages to.
@@ -147,6 +249,104 @@ void Spr_appendGroupFrame(struct Spr_Sprite *sprite, float const *delays,
 int Spr_write(struct Spr_Sprite *sprite, char const *filename,
         Spr_onError_fp errCB);
 
+/* Write a sprite out to a sink.
+ * name - Names the output in error messages.
+ * errCB - Callback called on error.
+ * Returns 0 on success, 1 on failure.
+ */
+int Spr_writeSink(struct Spr_Sprite *sprite, struct Spr_sink sink,
+        char const *name, Spr_onError_fp errCB);
+
+/* Sink writing to an open file descriptor, e.g. a pipe or standard output.  The
+ * descriptor is left open.
+ */
+struct Spr_sink Spr_fdSink(int fd);
+
+/* Sink appending to a memory buffer. */
+struct Spr_sink Spr_bufferSink(struct Spr_buffer *buffer);
+
+/* Open a file to write a sprite's frames to one at a time, so they need not all
+ * be held in memory.  The header and palette are written from sprite, which
+ * must outlive the writer; frames appended to the sprite itself are ignored.
+ * The file must be seekable: the frame count and group key times are patched
+ * in afterwards.
+ * filename - Also used in error messages, so must outlive the writer.
+ * errCB - Callback called on error, once per writer.
+ * Returns NULL on failure.
+ */
+struct Spr_Writer *Spr_newWriter(struct Spr_Sprite const *sprite,
+        char const *filename, Spr_onError_fp errCB);
+
+/* Write a single frame.  Returns 0 on success, 1 on failure. */
+int Spr_writeSingleFrame(struct Spr_Writer *writer,
+        struct Spr_image const *img);
+
+/* Start a group frame of exactly nImages images, to be written with
+ * Spr_writeGroupImage before any other frame.
+ * Returns 0 on success, 1 on failure.
+ */
+int Spr_beginGroupFrame(struct Spr_Writer *writer, int32_t nImages);
+
+/* Write the open group frame's next image.
+ * delay - Delay for the image in seconds.
+ * Returns 0 on success, 1 on failure.
+ */
+int Spr_writeGroupImage(struct Spr_Writer *writer, float delay,
+        struct Spr_image const *img);
+
+/* Patch in the frame count, close the file and free the writer.
+ * Returns 0 if the whole sprite was written, 1 on any failure.
+ */
+int Spr_closeWriter(struct Spr_Writer *writer);
+
+/* Map a sprite file (Quake or HL) into memory and index its frames without
+ * copying any pixels.
+ * errCB - Callback called on error, including malformed files.
+ * Returns NULL on failure.
+ */
+struct Spr_View *Spr_map(char const *filename, Spr_onError_fp errCB);
+
+/* Index a sprite file already in memory, as per Spr_map.  data must outlive the
+ * view.
+ * name - Names the data in error messages.
+ */
+struct Spr_View *Spr_read(void const *data, size_t size, char const *name,
+        Spr_onError_fp errCB);
+
+/* Deallocate the view's index, unmapping the file if it was mapped. */
+void Spr_freeView(struct Spr_View *view);
+
+struct Spr_info const *Spr_viewInfo(struct Spr_View const *view);
+
+/* Get frame number frame, from 0 to nFrames - 1. */
+struct Spr_frameView const *Spr_viewFrame(struct Spr_View const *view,
+        int32_t frame);
+
+/* Translate every raster in the view through lookup, in place.
+ * data - The writable buffer the view was made from by Spr_read.  Views made
+ *     by Spr_map are read-only and are rejected.
+ * lookup - 256 entries, e.g. from Spr_paletteTranslation.
+ * Returns 0 on success, 1 if the view can't be written.
+ */
+int Spr_translateView(struct Spr_View const *view, uint8_t *data,
+        uint8_t const *lookup, Spr_onError_fp errCB);
+
+/* Convert a sprite file to the other engine's format, without the source
+ * images.  Header fields carry over, radius included.
+ * Quake to HL: colors is embedded as the palette, and every image, group
+ *     images included, becomes a single frame.  Rasters are borrowed from the
+ *     view, which must outlive the sprite.
+ * HL to Quake: images are mapped to the nearest of colors, and gathered into
+ *     one group frame.  Images from group frames keep their delays; those
+ *     from single frames are shown for frameDelay seconds.  Index 255 stays
+ *     transparent only if it was, under alpha-test.  Index-alpha sprites'
+ *     indices aren't colors, so they can't be converted; NULL is returned.
+ * texType - HL texture type, ignored for Quake.
+ */
+struct Spr_Sprite *Spr_transcode(struct Spr_View const *view,
+        enum Spr_hlTextureType texType, uint16_t palColorCt,
+        struct Spr_color const *colors, float frameDelay);
+
 /* Read a raw 256-color 24bpp palette from file.
  * palette - Must have 256 colors (768 bytes) allocated.
  * Returns 0 on success, 1 on failure to read.
@@ -163,6 +363,73 @@ void Spr_defaultQPalette(struct Spr_color *colors);
  */
 uint8_t Spr_nearestIndex(struct Spr_Sprite *sprite, struct Spr_color color);
 
+/* Allocate a nearest color lookup cache for a palette.  Colors are copied.
+ * Colors exactly matching a palette entry are found by hashing.  Otherwise the
+ * cache is filled lazily, one cell of similar colors at a time, as queries are
+ * made against it.
+ */
+struct Spr_PalCache *Spr_newPalCache(uint16_t palColorCt,
+        struct Spr_color const *colors);
+
+/* Deallocate memory used by the palette cache. */
+void Spr_freePalCache(struct Spr_PalCache *cache);
+
+/* Find index in the cached palette with nearest color to the color provided.
+ * Gives the same result as Spr_nearestIndex for a sprite with that palette.
+ */
+uint8_t Spr_palCacheNearest(struct Spr_PalCache *cache,
+        struct Spr_color color);
+
+/* Build a k-d tree over a palette's colors, omitting the last color as
+ * Spr_nearestIndex does.  Colors are copied.
+ */
+struct Spr_PalTree *Spr_newPalTree(uint16_t palColorCt,
+        struct Spr_color const *colors);
+
+/* Deallocate memory used by the palette tree. */
+void Spr_freePalTree(struct Spr_PalTree *tree);
+
+/* Find index in the tree's palette with nearest color to the color provided.
+ * Gives the same result as Spr_nearestIndex for a sprite with that palette.
+ */
+uint8_t Spr_palTreeNearest(struct Spr_PalTree const *tree,
+        struct Spr_color color);
+
+/* Lay out a palette's colors for vectorized searching, omitting the last color
+ * as Spr_nearestIndex does.  Colors are copied.  The widest kernel supported by
+ * the running CPU (AVX2, SSE2, or plain C) is selected here.
+ */
+struct Spr_PalVec *Spr_newPalVec(uint16_t palColorCt,
+        struct Spr_color const *colors);
+
+/* Deallocate memory used by the vectorized palette. */
+void Spr_freePalVec(struct Spr_PalVec *vec);
+
+/* Find index in the vectorized palette with nearest color to the color
+ * provided.  Gives the same result as Spr_nearestIndex for a sprite with that
+ * palette.
+ */
+uint8_t Spr_palVecNearest(struct Spr_PalVec const *vec,
+        struct Spr_color color);
+
+/* Find nearest palette index for each of colorCt colors, as per
+ * Spr_palVecNearest.
+ * indices - Must have colorCt bytes allocated.
+ */
+void Spr_palVecNearestBatch(struct Spr_PalVec const *vec,
+        struct Spr_color const *colors, size_t colorCt, uint8_t *indices);
+
+/* Build a table translating indices into one palette to the nearest colors in
+ * another, as per Spr_nearestIndex for a sprite with palette to.  Indices
+ * beyond fromColorCt are kept as they are.
+ * keepTransIdx - Keep the transparent index as it is too, rather than mapping
+ *     it by color, for palettes where it doesn't stand for a color.
+ * lookup - Must have 256 bytes allocated.
+ */
+void Spr_paletteTranslation(uint16_t fromColorCt,
+        struct Spr_color const *from, uint16_t toColorCt,
+        struct Spr_color const *to, bool keepTransIdx, uint8_t *lookup);
+
 /* Get 0-255 brightness of color using nearestIndex's color weights.
  */
 uint8_t Spr_brightness(struct Spr_color color);